@@ -5,6 +5,7 @@
 #endif /* CONFIG_64BIT */
 
 #define BITS_PER_BYTE           8
+#define BITS_PER_LONG_LONG      64
 #define DIV_ROUND_UP(n,d) (((n) + (d) - 1) / (d))
 
 #define BIT(nr)                 (1U << (nr))
@@ -27,6 +28,9 @@
 #define GENMASK(h, l) \
 	(((~0U) << (l)) & (~0U >> (BITS_PER_LONG  - (h) - 1)))
 
+#define GENMASK_ULL(h, l) \
+	(((~0ULL) << (l)) & (~0ULL >> (BITS_PER_LONG_LONG - (h) - 1)))
+
 #define NBITS2(n) ((n&2)?1:0)
 #define NBITS4(n) ((n&(0xC))?(2+NBITS2(n>>2)):(NBITS2(n)))
 #define NBITS8(n) ((n&0xF0)?(4+NBITS4(n>>4)):(NBITS4(n)))
@@ -76,13 +76,24 @@ struct pcb_t {
 	uint32_t prio;     
 #endif
 #ifdef CPU_TLB
-	struct memphy_struct *tlb;
+	struct tlb_struct *tlb;
+#endif
+#ifdef CPUTLB_PREFETCH
+	int tlb_pf_vpn;    // Last page which missed the TLB
+	int tlb_pf_stride; // Last VPN stride between two misses
+#endif
+#ifdef CPU_CYCLE_MODEL
+	unsigned long cycles; // Simulated cycles spent on memory accesses
 #endif
 #ifdef MM_PAGING
 	struct mm_struct *mm;
 	struct memphy_struct *mram;
 	struct memphy_struct **mswp;
 	struct memphy_struct *active_mswp;
+#ifdef MM_XLATE_CACHE
+	struct xlate_entry_struct xlc[MM_XLATE_CACHE]; // Last region page translations
+	int xlc_next; // Next entry to replace
+#endif
 #endif
 	struct page_table_t * page_table; // Page table
 	uint32_t bp;	// Break pointer
@@ -5,83 +5,126 @@
 #include <pthread.h>
 
 
-/* CPU Bus definition */
-#define PAGING_CPU_BUS_WIDTH 22 /* 22bit bus - MAX SPACE 4MB */
-#define PAGING_PAGESZ 256       /* 256B or 8-bits PAGE NUMBER */
-#define PAGING_MEMRAMSZ BIT(10) /* 1MB */
+/* CPU Bus definition, read from the config at startup (paging_geom_init) */
+#define PAGING_DEFAULT_BUS_WIDTH 22 /* 22bit bus - MAX SPACE 4MB */
+#define PAGING_DEFAULT_PAGESZ 256   /* 256B or 8-bits PAGE NUMBER */
+#define PAGING_MAX_BUS_WIDTH 32     /* virtual addresses are uint32_t */
+#define PAGING_MIN_PAGESZ 64
+#define PAGING_MAX_PAGESZ BIT(20)
+
+extern struct paging_geom_struct paging_geom;
+
+#define PAGING_CPU_BUS_WIDTH (paging_geom.bus_width)
+#define PAGING_PAGESZ (paging_geom.pagesz)
+#define PAGING_PAGE_SHIFT (paging_geom.page_shift)
 #define PAGING_PAGE_ALIGNSZ(sz)                                                \
   (DIV_ROUND_UP(sz, PAGING_PAGESZ) * PAGING_PAGESZ)
 
-#define PAGING_MEMSWPSZ BIT(14) /* 16MB */
-#define PAGING_SWPFPN_OFFSET 5
-#define PAGING_MAX_PGN (DIV_ROUND_UP(BIT(PAGING_CPU_BUS_WIDTH), PAGING_PAGESZ))
+#define PAGING_MAX_PGN (paging_geom.max_pgn)
+/* Radix page table levels, the last one holds the leaves */
+#define PAGING_PT_LEVELS (paging_geom.pt_levels)
 
 #define PAGING_SBRK_INIT_SZ PAGING_PAGESZ
-/* PTE BIT */
-#define PAGING_PTE_PRESENT_MASK BIT(31)
-#define PAGING_PTE_SWAPPED_MASK BIT(30)
-#define PAGING_PTE_RESERVE_MASK BIT(29)
-#define PAGING_PTE_DIRTY_MASK BIT(28)
-#define PAGING_PTE_EMPTY01_MASK BIT(14)
-#define PAGING_PTE_EMPTY02_MASK BIT(13)
+
+/* Huge page: an aligned span of pages backed by an aligned frame run */
+#ifdef MM_HUGEPAGE
+#define PAGING_HPAGE_ORDER MM_HUGEPAGE_ORDER
+#else
+#define PAGING_HPAGE_ORDER 0
+#endif
+#define PAGING_HPAGE_NR (1 << PAGING_HPAGE_ORDER)
+#define PAGING_HPAGESZ (PAGING_HPAGE_NR * PAGING_PAGESZ)
+/* First page of the span holding a page, index of the page in it */
+#define PAGING_HPAGE_PGN(pgn) ((pgn) & ~(PAGING_HPAGE_NR - 1))
+#define PAGING_HPAGE_IDX(pgn) ((pgn) & (PAGING_HPAGE_NR - 1))
+/* PTE BIT, flags sit above the 40 bit FPN/SWPOFF fields of the 64 bit PTE */
+#define PAGING_PTE_PRESENT_MASK BIT_ULL(63)
+#define PAGING_PTE_SWAPPED_MASK BIT_ULL(62)
+#define PAGING_PTE_RESERVE_MASK BIT_ULL(61)
+#define PAGING_PTE_DIRTY_MASK BIT_ULL(60)
+#define PAGING_PTE_EMPTY01_MASK BIT_ULL(59)
+#define PAGING_PTE_EMPTY02_MASK BIT_ULL(58)
+
+/* Page brought in by swap readahead and not accessed yet */
+#define PAGING_PTE_RAHEAD_MASK PAGING_PTE_EMPTY01_MASK
+/* Page mapped read-only on a shared frame, copy on first store */
+#define PAGING_PTE_COW_MASK PAGING_PTE_EMPTY02_MASK
+/* Page of a huge page, every PTE of the span maps the same frame run */
+#define PAGING_PTE_HUGE_MASK BIT_ULL(57)
 
 /* PTE BIT PRESENT */
 #define PAGING_PTE_SET_PRESENT(pte) (pte = pte | PAGING_PTE_PRESENT_MASK)
 #define PAGING_PAGE_PRESENT(pte) (pte & PAGING_PTE_PRESENT_MASK)
 
+/* PTE BIT SWAPPED */
+#define PAGING_PAGE_SWAPPED(pte) (pte & PAGING_PTE_SWAPPED_MASK)
+
+/* PTE online ~ present in MEMRAM */
+#define PAGING_PAGE_ONLINE(pte)                                                \
+  ((pte & (PAGING_PTE_PRESENT_MASK | PAGING_PTE_SWAPPED_MASK)) ==              \
+   PAGING_PTE_PRESENT_MASK)
+
+/* PTE BIT DIRTY */
+#define PAGING_PTE_SET_DIRTY(pte) (pte = pte | PAGING_PTE_DIRTY_MASK)
+#define PAGING_PAGE_DIRTY(pte) (pte & PAGING_PTE_DIRTY_MASK)
+
+/* A store needs no PTE update: already dirty and not copy-on-write */
+#define PAGING_PAGE_WRITABLE(pte)                                              \
+  (PAGING_PAGE_DIRTY(pte) && !((pte) & PAGING_PTE_COW_MASK))
+
 /* USRNUM */
-#define PAGING_PTE_USRNUM_LOBIT 15
-#define PAGING_PTE_USRNUM_HIBIT 27
+#define PAGING_PTE_USRNUM_LOBIT 45
+#define PAGING_PTE_USRNUM_HIBIT 56
 /* FPN */
 #define PAGING_PTE_FPN_LOBIT 0
-#define PAGING_PTE_FPN_HIBIT 12
+#define PAGING_PTE_FPN_HIBIT 39
 /* SWPTYP */
 #define PAGING_PTE_SWPTYP_LOBIT 0
 #define PAGING_PTE_SWPTYP_HIBIT 4
 /* SWPOFF */
 #define PAGING_PTE_SWPOFF_LOBIT 5
-#define PAGING_PTE_SWPOFF_HIBIT 25
+#define PAGING_PTE_SWPOFF_HIBIT 44
 
 /* PTE masks */
 #define PAGING_PTE_USRNUM_MASK                                                 \
-  GENMASK(PAGING_PTE_USRNUM_HIBIT, PAGING_PTE_USRNUM_LOBIT)
-#define PAGING_PTE_FPN_MASK GENMASK(PAGING_PTE_FPN_HIBIT, PAGING_PTE_FPN_LOBIT)
+  GENMASK_ULL(PAGING_PTE_USRNUM_HIBIT, PAGING_PTE_USRNUM_LOBIT)
+#define PAGING_PTE_FPN_MASK                                                    \
+  GENMASK_ULL(PAGING_PTE_FPN_HIBIT, PAGING_PTE_FPN_LOBIT)
 #define PAGING_PTE_SWPTYP_MASK                                                 \
-  GENMASK(PAGING_PTE_SWPTYP_HIBIT, PAGING_PTE_SWPTYP_LOBIT)
+  GENMASK_ULL(PAGING_PTE_SWPTYP_HIBIT, PAGING_PTE_SWPTYP_LOBIT)
 #define PAGING_PTE_SWPOFF_MASK                                                 \
-  GENMASK(PAGING_PTE_SWPOFF_HIBIT, PAGING_PTE_SWPOFF_LOBIT)
+  GENMASK_ULL(PAGING_PTE_SWPOFF_HIBIT, PAGING_PTE_SWPOFF_LOBIT)
 
 /* OFFSET */
 #define PAGING_ADDR_OFFST_LOBIT 0
-#define PAGING_ADDR_OFFST_HIBIT (NBITS(PAGING_PAGESZ) - 1)
+#define PAGING_ADDR_OFFST_HIBIT (PAGING_PAGE_SHIFT - 1)
 
 /* PAGE Num */
-#define PAGING_ADDR_PGN_LOBIT NBITS(PAGING_PAGESZ)
+#define PAGING_ADDR_PGN_LOBIT PAGING_PAGE_SHIFT
 #define PAGING_ADDR_PGN_HIBIT (PAGING_CPU_BUS_WIDTH - 1)
 
-/* Frame PHY Num */
-#define PAGING_ADDR_FPN_LOBIT NBITS(PAGING_PAGESZ)
-#define PAGING_ADDR_FPN_HIBIT (NBITS(PAGING_MEMRAMSZ) - 1)
+/* Frame PHY Num, the MEMPHY sizes are runtime so frame numbers are only
+ * bounded by the PTE field */
+#define PAGING_ADDR_FPN_LOBIT PAGING_PAGE_SHIFT
 
 /* SWAPFPN */
-#define PAGING_SWP_LOBIT NBITS(PAGING_PAGESZ)
-#define PAGING_SWP_HIBIT (NBITS(PAGING_MEMSWPSZ) - 1)
-#define PAGING_SWP(pte) ((pte & PAGING_SWP_MASK) >> PAGING_SWPFPN_OFFSET)
+#define PAGING_SWP(pte)                                                        \
+  GETVAL(pte, PAGING_PTE_SWPOFF_MASK, PAGING_PTE_SWPOFF_LOBIT)
+/* MEMPHY address of a byte in a frame */
+#define PAGING_PHYADDR(fpn, off)                                               \
+  (((paddr_t)(fpn) << PAGING_ADDR_FPN_LOBIT) + (off))
 
 /* Value operators */
 #define SETBIT(v, mask) (v = v | mask)
 #define CLRBIT(v, mask) (v = v & ~mask)
 
 #define SETVAL(v, value, mask, offst)                                          \
-  (v = (v & ~mask) | ((value << offst) & mask))
+  (v = (v & ~mask) | (((uint64_t)(value) << offst) & mask))
 #define GETVAL(v, mask, offst) ((v & mask) >> offst)
 
-/* Other masks */
-#define PAGING_OFFST_MASK                                                      \
-  GENMASK(PAGING_ADDR_OFFST_HIBIT, PAGING_ADDR_OFFST_LOBIT)
-#define PAGING_PGN_MASK GENMASK(PAGING_ADDR_PGN_HIBIT, PAGING_ADDR_PGN_LOBIT)
-#define PAGING_FPN_MASK GENMASK(PAGING_ADDR_FPN_HIBIT, PAGING_ADDR_FPN_LOBIT)
-#define PAGING_SWP_MASK GENMASK(PAGING_SWP_HIBIT, PAGING_SWP_LOBIT)
+/* Other masks, the address ones are computed once in paging_geom */
+#define PAGING_OFFST_MASK (paging_geom.offst_mask)
+#define PAGING_PGN_MASK (paging_geom.pgn_mask)
 
 /* Extract OFFSET */
 //#define PAGING_OFFST(x)  ((x&PAGING_OFFST_MASK) >> PAGING_ADDR_OFFST_LOBIT)
@@ -89,12 +132,9 @@
 /* Extract Page Number*/
 #define PAGING_PGN(x) GETVAL(x, PAGING_PGN_MASK, PAGING_ADDR_PGN_LOBIT)
 /* Extract FramePHY Number*/
-// #define PAGING_FPN(x)  GETVAL(x,PAGING_FPN_MASK,PAGING_ADDR_FPN_LOBIT)
-#define PAGING_FPN(x) (x & 8191)
-/* Extract SWAPFPN */
-#define PAGING_PGN(x) GETVAL(x, PAGING_PGN_MASK, PAGING_ADDR_PGN_LOBIT)
+#define PAGING_FPN(x) GETVAL(x, PAGING_PTE_FPN_MASK, PAGING_PTE_FPN_LOBIT)
+/* Extract SWAPFPN, see PAGING_SWP */
 /* Extract SWAPTYPE */
-// #define PAGING_FPN(x)  GETVAL(x,PAGING_FPN_MASK,PAGING_ADDR_FPN_LOBIT)
 #define PAGING_SWPTYP(x)                                                       \
   GETVAL(x, PAGING_PTE_SWPTYP_MASK, PAGING_PTE_SWPTYP_LOBIT)
 
@@ -107,18 +147,33 @@ struct vm_rg_struct *init_vm_rg(int rg_start, int rg_endi);
 int enlist_vm_rg_node(struct vm_rg_struct **rglist,
                       struct vm_rg_struct *rgnode);
 int enlist_pgn_node(struct pgn_t **pgnlist, int pgn);
+int vmrg_free(struct vm_area_struct *vma, unsigned long start,
+              unsigned long end);
+unsigned long vmrg_largest(struct vm_area_struct *vma);
+void vmrg_free_all(struct vm_area_struct *vma);
+struct vm_area_struct *vma_create(struct mm_struct *mm, int vmaid,
+                                  unsigned long start, unsigned long flags);
+struct vm_area_struct *find_vma(struct mm_struct *mm, unsigned long addr);
+struct vm_area_struct *vma_find_overlap(struct mm_struct *mm,
+                                        unsigned long start, unsigned long end,
+                                        struct vm_area_struct *skip);
+int vma_set_end(struct mm_struct *mm, struct vm_area_struct *vma,
+                unsigned long end);
+void vma_free_all(struct mm_struct *mm);
 int vmap_page_range(struct pcb_t *caller, int addr, int pgnum,
                     struct framephy_struct *frames,
                     struct vm_rg_struct *ret_rg);
 int vm_map_ram(struct pcb_t *caller, int astart, int send, int mapstart,
                int incpgnum, struct vm_rg_struct *ret_rg);
+int vm_map_pages(struct pcb_t *caller, int mapstart, int incpgnum,
+                 struct vm_rg_struct *ret_rg);
 int alloc_pages_range(struct pcb_t *caller, int incpgnum,
                       struct framephy_struct **frm_lst);
 int __swap_cp_page(struct memphy_struct *mpsrc, int srcfpn,
                    struct memphy_struct *mpdst, int dstfpn);
-int pte_set_fpn(uint32_t *pte, int fpn);
-int pte_set_swap(uint32_t *pte, int swptyp, int swpoff);
-int init_pte(uint32_t *pte,
+int pte_set_fpn(struct mm_struct *mm, int pgn, int fpn);
+int pte_set_swap(struct mm_struct *mm, int pgn, int swptyp, int swpoff);
+int init_pte(pte_t *pte,
              int pre,     // present
              int fpn,     // FPN
              int drt,     // dirty
@@ -131,27 +186,70 @@ int __free(struct pcb_t *caller, int vmaid, int rgid);
 int __read(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE *data);
 int __write(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE value);
 int init_mm(struct mm_struct *mm, struct pcb_t *caller);
+int exit_mm(struct pcb_t *caller);
+int paging_geom_init(int pagesz, int bus_width);
+
+/* Page table prototypes */
+typedef int (*pt_walk_fn)(struct mm_struct *mm, int pgn, pte_t *pte,
+                          void *arg);
+int pt_init(struct mm_struct *mm);
+void pt_free(struct mm_struct *mm);
+pte_t *pte_lookup(struct mm_struct *mm, int pgn);
+pte_t *pte_alloc(struct mm_struct *mm, int pgn, int online);
+pte_t pte_get(struct mm_struct *mm, int pgn);
+int *pte_swpslot(struct mm_struct *mm, int pgn);
+int pt_walk(struct mm_struct *mm, int pgn_start, int pgn_end, pt_walk_fn fn,
+            void *arg);
+unsigned long pt_mem_size(struct mm_struct *mm);
+int print_pt_stat(void);
+#ifdef MM_IPT
+int init_ipt(struct memphy_struct *mram);
+#endif
+
+/* TLB entry tag: valid bit, huge bit, ASID in bits 32-61, VPN in bits 0-31 */
+#define TLB_TAG_VALID (1ULL << 63)
+#define TLB_TAG_HUGE (1ULL << 62) /* VPN is a huge page number */
+#define TLB_TAG(asid, vpn)                                                     \
+  (TLB_TAG_VALID | ((uint64_t)((asid) & 0x3fffffff) << 32) | (uint32_t)(vpn))
+#define TLB_TAG_HPAGE(asid, vpn)                                               \
+  (TLB_TAG((asid), (uint32_t)(vpn) >> PAGING_HPAGE_ORDER) | TLB_TAG_HUGE)
+#define TLB_TAG_ASID(tag) (((tag) >> 32) & 0x3fffffff)
+#define TLB_TAG_VPN(tag) ((tag) & 0xffffffff)
+#define TLB_ASID_MASK ((1ULL << CPUTLB_ASID_BITS) - 1)
+#define TLB_ASID_GEN(asid) ((asid) >> CPUTLB_ASID_BITS)
+/* TLB entry frame number, flagged when stores may hit the entry */
+#define TLB_PFN_WRITABLE (1 << 30)
+#define TLB_PFN_PREFETCH (1 << 29) /* filled ahead, not hit yet */
+#define TLB_PFN(pfn) ((pfn) & ~(TLB_PFN_WRITABLE | TLB_PFN_PREFETCH))
+/* Bit of a TLB in mm->tlb_mask, TLBs beyond 64 share bits */
+#define TLB_MASK_BIT(id) (1ULL << ((id) % 64))
+/* Storage of an entry: tag, frame number and LRU stamp */
+#define TLB_ENTRY_SZ (sizeof(uint64_t) + sizeof(int) + sizeof(unsigned long))
 
 /* CPUTLB prototypes */
-int tlb_change_all_page_tables_of(struct pcb_t *proc, struct memphy_struct *mp);
-int tlb_flush_tlb_of(struct pcb_t *proc, struct memphy_struct *mp);
+int tlb_change_all_page_tables_of(struct pcb_t *proc, struct tlb_struct *tlb);
+int tlb_flush_tlb_of(struct pcb_t *proc, struct tlb_struct *tlb);
 int tlballoc(struct pcb_t *proc, uint32_t size, uint32_t reg_index);
 int tlbfree_data(struct pcb_t *proc, uint32_t reg_index);
 
-int init_tlbmemphy(struct memphy_struct *mp, int max_size);
-int TLBMEMPHY_read(struct memphy_struct *mp, int addr, BYTE *value);
-int TLBMEMPHY_write(struct memphy_struct *mp, int addr, BYTE data);
-int TLBMEMPHY_dump(struct memphy_struct *mp);
-
 /* Our group's code */
-int tlb_cache_read(struct pcb_t *proc, struct memphy_struct *mp, int pid,
-                   int pgnum, BYTE *value);
-int tlb_cache_write(struct pcb_t *proc, struct memphy_struct *mp, int pid,
-                    int pgnum, BYTE value);
-int TLBMEMPHY_read(struct memphy_struct *mp, int addr, BYTE *value);
-int TLBMEMPHY_write(struct memphy_struct *mp, int addr, BYTE data);
-int TLBMEMPHY_dump(struct memphy_struct *mp);
-int init_tlbmemphy(struct memphy_struct *mp, int max_size);
+uint64_t tlb_get_asid(struct mm_struct *mm);
+int tlb_cache_read(struct pcb_t *proc, struct tlb_struct *tlb, int pgnum,
+                   int *fpn);
+int tlb_cache_write(struct pcb_t *proc, struct tlb_struct *tlb, int pgnum,
+                    int fpn, int writable);
+int tlb_cache_access(struct pcb_t *proc, struct tlb_struct *tlb, int addr,
+                     BYTE *data, int write);
+int tlb_cache_write_hpage(struct pcb_t *proc, struct tlb_struct *tlb, int pgnum,
+                          int fpn, int writable);
+int tlb_cache_prefetch(struct pcb_t *proc, struct tlb_struct *tlb, int pgnum,
+                       int fpn, int writable);
+void tlb_prefetch(struct pcb_t *proc, int pgnum);
+int tlb_shootdown(struct mm_struct *mm, int vpn_start, int vpn_end);
+unsigned long tlb_latency(struct tlb_struct *tlb, int level);
+int TLB_dump(struct tlb_struct *tlb);
+int print_tlb_stat(struct tlb_struct *tlb, const char *name);
+int init_tlb(struct tlb_struct *tlb, int max_size, int l1_entries, int ways);
 int free_pcb_memph(struct pcb_t *caller);
 int tlbread(struct pcb_t *proc, uint32_t source, uint32_t offset,
             uint32_t destination);
@@ -173,21 +271,116 @@ int pgwrite(struct pcb_t *proc,   // Process executing the instruction
             uint32_t offset);
 /* Local VM prototypes */
 struct vm_rg_struct *get_symrg_byid(struct mm_struct *mm, int rgid);
+struct vm_rg_struct *set_symrg_byid(struct mm_struct *mm, int rgid);
+int init_symtbl(struct mm_struct *mm);
+void free_symtbl(struct mm_struct *mm);
 int validate_overlap_vm_area(struct pcb_t *caller, int vmaid, int vmastart,
                              int vmaend);
 int get_free_vmrg_area(struct pcb_t *caller, int vmaid, int size,
                        struct vm_rg_struct *newrg);
 int inc_vma_limit(struct pcb_t *caller, int vmaid, int inc_sz);
 int find_victim_page(struct mm_struct *mm, int *pgn);
+int swap_out_page(struct pcb_t *caller, int vicpgn, int *vicfpn);
+int alloc_frame(struct pcb_t *caller, int *fpn);
+int __reclaim_frame(struct mm_struct *held, struct memphy_struct *mram,
+                    struct memphy_struct *mswp, int fpn);
+int __swap_out_page(struct mm_struct *mm, struct memphy_struct *mram,
+                    struct memphy_struct *mswp, int vicpgn, int *vicfpn);
+int delist_pgn_node(struct pgn_t **pgnlist, int pgn);
+int __swap_in_page(struct mm_struct *mm, struct memphy_struct *mram,
+                   struct memphy_struct *mswp, int pgn, int fpn);
+#ifdef MM_XLATE_CACHE
+void xlate_inval(struct mm_struct *mm, int pgn_start, int pgn_end);
+#endif
+#ifdef MM_ZERO_PAGE
+int vmap_zero_page_range(struct pcb_t *caller, int addr, int pgnum,
+                         struct vm_rg_struct *ret_rg);
+int do_cow_page(struct mm_struct *mm, int pgn, struct pcb_t *caller);
+#endif
+#ifdef MM_KSM
+/* Same page merging daemon */
+struct ksmd_args {
+  struct timer_id_t *timer_id;
+  struct memphy_struct *mram;
+};
+
+void *ksmd_routine(void *args);
+void ksmd_stop(void);
+int ksm_scan(struct memphy_struct *mram, int nr_pages);
+int print_ksm_stat(struct memphy_struct *mram);
+#endif
+#ifdef MM_HUGEPAGE
+/* Huge pages */
+int init_hpage_pool(struct memphy_struct *mram, int percent);
+int hpage_alloc(struct memphy_struct *mram, int *fpn);
+int hpage_get_frame(struct memphy_struct *mram, int *fpn);
+int hpage_put_frame(struct memphy_struct *mram, int fpn);
+int hpage_promote(struct mm_struct *mm, int pgn, struct pcb_t *caller);
+int hpage_demote(struct mm_struct *mm, int pgn);
+int hpage_set_dirty(struct mm_struct *mm, int pgn);
+int vmap_hpage_range(struct pcb_t *caller, int addr, int pgnum,
+                     struct vm_rg_struct *ret_rg);
+int print_hpage_stat(struct memphy_struct *mram);
+#endif
+#ifdef MM_SWAP_READAHEAD
+int swap_readahead(struct mm_struct *mm, int pgn, struct pcb_t *caller);
+#endif
+
+/* Single lock of the whole MM, used by every mm with MM_BIGLOCK */
+extern pthread_mutex_t mmvm_lock;
+
+/*
+ * Locking order: mm lock (MM_LOCKP) -> frame stripe (MEMPHY_lock_frame)
+ * -> zswap pool lock. The CPU owning a process blocks on its mm lock,
+ * kswapd and ksmd only trylock the lock of another mm and skip the frame
+ * when it is busy; they do it before dropping the lock of the frame they
+ * found the mm on, exit_mm clears owners under both. Free frame pools are
+ * lock-free.
+ */
+#ifdef MM_BIGLOCK
+#define MM_LOCKP(mm) (&mmvm_lock)
+#else
+#define MM_LOCKP(mm) (&(mm)->lock)
+#endif
+
+#ifdef MM_KSWAPD
+/* Background reclaim daemon */
+struct kswapd_args {
+  struct timer_id_t *timer_id;
+  struct memphy_struct *mram;
+  struct memphy_struct *mswp;
+};
+
+void *kswapd_routine(void *args);
+void kswapd_stop(void);
+int kswapd_balance(struct memphy_struct *mram, struct memphy_struct *mswp);
+int print_kswapd_stat(void);
+#endif
 struct vm_area_struct *get_vma_by_num(struct mm_struct *mm, int vmaid);
 
+#ifdef MM_ZSWAP
+/* Compressed swap cache */
+int init_zswap(struct memphy_struct *mswp, long pool_sz);
+int zswap_store(struct zswap_struct *zs, struct memphy_struct *mram, int fpn,
+                int swpfpn);
+int zswap_load(struct zswap_struct *zs, int swpfpn, struct memphy_struct *mram,
+               int fpn);
+int zswap_invalidate(struct zswap_struct *zs, int swpfpn);
+int print_zswap_stat(struct zswap_struct *zs);
+#endif
+
 /* MEM/PHY protypes */
 int MEMPHY_get_freefp(struct memphy_struct *mp, int *fpn);
 int MEMPHY_put_freefp(struct memphy_struct *mp, int fpn);
-int MEMPHY_read(struct memphy_struct *mp, int addr, BYTE *value);
-int MEMPHY_write(struct memphy_struct *mp, int addr, BYTE data);
+int MEMPHY_set_rmap(struct memphy_struct *mp, int fpn, struct mm_struct *owner,
+                    int pgn);
+void MEMPHY_lock_frame(struct memphy_struct *mp, int fpn);
+void MEMPHY_unlock_frame(struct memphy_struct *mp, int fpn);
+int MEMPHY_read(struct memphy_struct *mp, paddr_t addr, BYTE *value);
+int MEMPHY_write(struct memphy_struct *mp, paddr_t addr, BYTE data);
 int MEMPHY_dump(struct memphy_struct *mp);
-int init_memphy(struct memphy_struct *mp, int max_size, int randomflg);
+int print_memphy_stat(struct memphy_struct *mp, const char *name);
+int init_memphy(struct memphy_struct *mp, paddr_t max_size, int randomflg);
 /* DEBUG */
 int print_list_fp(struct framephy_struct *fp);
 int print_list_rg(struct vm_rg_struct *rg);
@@ -195,4 +388,5 @@ int print_list_vma(struct vm_area_struct *rg);
 
 int print_list_pgn(struct pgn_t *ip);
 int print_pgtbl(struct pcb_t *ip, uint32_t start, uint32_t end);
+int print_mm_stat(struct pcb_t *ip);
 #endif
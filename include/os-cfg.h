@@ -6,11 +6,46 @@
 
 #define CPU_TLB
 #define CPUTLB_FIXED_TLBSZ
+#define CPUTLB_WAYS 4         /* L2 TLB associativity */
+#define CPUTLB_L1_ENTRIES 8   /* fully associative L1 TLB, 0 for none */
+#define CPUTLB_PREFETCH 2     /* TLB entries filled ahead of a VPN stride */
+#define CPUTLB_ASID_BITS 8    /* hardware ASIDs, 0 is never handed out */
+#define CPUTLB_INVAL_SLOTS 16 /* shootdowns pending on a TLB, then flush */
+#define CPU_CYCLE_MODEL       /* charge simulated cycles to memory accesses */
+#define CYCLE_TLB_HIT 1       /* translation found in the (L1) TLB */
+#define CYCLE_TLB_L2_HIT 7    /* added on an L1 miss served by the L2 */
+#define CYCLE_TLB_MISS 30     /* page walk on a TLB miss */
+#define CYCLE_RAM 100         /* one MEMRAM access */
+#define CYCLE_SWAP_IN 20000   /* one page read from MEMSWP */
+#define CYCLE_SWAP_OUT 20000  /* one victim evicted on the faulting path */
 #define MM_PAGING
+#define MM_IPT /* os --ipt: one inverted page table for all processes */
+//#define MM_BIGLOCK /* one global MM lock instead of per mm/frame locks */
+#define MM_KSWAPD
+#define MM_KSWAPD_LOWMARK 5   /* wake up below 5% free MEMRAM frames */
+#define MM_KSWAPD_HIGHMARK 10 /* reclaim until 10% MEMRAM frames are free */
+#define MM_KSWAPD_BATCH 8     /* max frames reclaimed per time slot */
+#define MM_SWAP_READAHEAD 4   /* max pages read ahead of a swap fault */
+#define MM_SWAP_SEQ           /* MEMSWP are sequential (tape/disk) devices */
+#define MM_SEQ_SEEK_COST 100  /* fixed cost of moving a sequential head */
+#define MM_SEQ_SEEK_BYTE_COST 1 /* added cost per byte the head travels */
+#define MM_SEQ_XFER_COST 1    /* cost per byte transferred */
+#define MM_ZSWAP
+#define MM_ZSWAP_MAX_POOL_PERCENT 20 /* zswap pool budget, % of MEMRAM */
+#define MM_ZERO_PAGE
+#define MM_KSM
+#define MM_KSM_BATCH 16 /* frames scanned for merging per time slot */
+#define MM_HUGEPAGE
+#define MM_HUGEPAGE_ORDER 4 /* a huge page spans 1 << 4 pages, at most 6 */
+#define MM_HUGEPAGE_POOL_PERCENT 25 /* MEMRAM kept in aligned frame runs */
+#ifndef CPU_TLB /* a TLB serves the repeated accesses, it would never hit */
+#define MM_XLATE_CACHE 4 /* region page translations cached per process */
+#endif
 //#define MM_FIXED_MEMSZ
 //#define VMDBG 1
 //#define MMDBG 1
 #define IODUMP 1
 #define PAGETBL_DUMP 1
+#define MMSTAT_DUMP 1
 
 #endif
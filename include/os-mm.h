@@ -1,12 +1,15 @@
 #ifndef OSMM_H
 #define OSMM_H
 
+#include <sys/types.h> /* pthread_mutex_t, <pthread.h> reaches back here via sched.h */
+
 #define MM_PAGING
 #define PAGING_MAX_MMSWP 4 /* max number of supported swapped space */
-#define PAGING_MAX_SYMTBL_SZ 30
+#define PAGING_SYMTBL_INIT_SZ 32 /* region IDs of the dense table at start */
 
 typedef char BYTE;
 typedef uint32_t addr_t;
+typedef uint64_t paddr_t; /* MEMPHY address */
 //typedef unsigned int uint32_t;
 
 struct pgn_t{
@@ -22,8 +25,44 @@ struct vm_rg_struct {
    unsigned long rg_end;
 
    struct vm_rg_struct *rg_next;
+
+   /* Free region links, see mm-vmrg.c */
+   struct vm_rg_struct *rg_prev;  /* previous region of the size class bin */
+   struct vm_rg_struct *rg_snext; /* boundary tag chain of rg_start */
+   struct vm_rg_struct *rg_enext; /* boundary tag chain of rg_end */
+};
+
+/*
+ *  Symbol table entry of a sparse region ID, chained in its hash bucket
+ */
+struct vm_symrg_struct {
+   int rgid;
+   struct vm_rg_struct rg;
+   struct vm_symrg_struct *next;
 };
 
+/*
+ *  Cached translation of a region page, see MM_XLATE_CACHE
+ */
+struct xlate_entry_struct {
+   int rgid;      /* -1 if invalid */
+   int pgn;
+   long off_lo;   /* region offset of the first byte of the page */
+   paddr_t fbase; /* MEMRAM address of the frame */
+   int writable;  /* PAGING_PAGE_WRITABLE when cached */
+};
+
+/* Free region size classes, bin k holds regions of [2^k, 2^(k+1)) bytes */
+#define VM_RG_NR_BINS 32
+#define VM_RG_TAG_MIN_SHIFT 4 /* boundary tag table starts at 16 buckets */
+
+/* Kinds of memory area, vm_flags */
+#define VM_AREA_HEAP 0x1
+#define VM_AREA_STACK 0x2
+#define VM_AREA_SHARED 0x4
+#define VM_AREA_FILE 0x8
+#define PAGING_MAX_VMA 8 /* memory areas per process, IDs 0 to 7 */
+
 /*
  *  Memory area struct
  */
@@ -31,6 +70,7 @@ struct vm_area_struct {
    unsigned long vm_id;
    unsigned long vm_start;
    unsigned long vm_end;
+   unsigned long vm_flags;
 
    unsigned long sbrk;
 /*
@@ -38,23 +78,200 @@ struct vm_area_struct {
  * unsigned long vm_limit = vm_end - vm_start
  */
    struct mm_struct *vm_mm;
-   struct vm_rg_struct *vm_freerg_list;
+
+   /* Free regions binned by size class, bit k of the map set if bin k is
+    * not empty; both ends are hashed as boundary tags for coalescing */
+   struct vm_rg_struct *vm_freerg_bin[VM_RG_NR_BINS];
+   uint32_t vm_freerg_binmap;
+   struct vm_rg_struct **vm_rgtag_start;
+   struct vm_rg_struct **vm_rgtag_end;
+   int vm_rgtag_shift; /* log2 of the tag table size, 0 until first used */
+   int vm_nr_freerg;
+   unsigned long vm_freerg_bytes;
+
+   /* Next area in address order */
    struct vm_area_struct *vm_next;
+
+   /* Interval tree of the areas of an mm, see mm-vma.c */
+   struct vm_area_struct *vm_left;
+   struct vm_area_struct *vm_right;
+   int vm_height;
+   unsigned long vm_subtree_end; /* highest vm_end in the subtree */
+};
+
+/*
+ * Per-process paging statistics
+ */
+struct mm_stat_struct {
+   unsigned long swpin;    /* pages copied from MEMSWP into MEMRAM */
+   unsigned long swpout;   /* pages written back to MEMSWP */
+   unsigned long swpclean; /* clean victims dropped without write back */
+   unsigned long reclaim;  /* victims evicted on the faulting path */
+   unsigned long ra_issued; /* pages brought in by swap readahead */
+   unsigned long ra_hit;    /* readahead pages accessed afterwards */
+   unsigned long ra_waste;  /* readahead pages evicted untouched */
+   unsigned long zeromap;   /* pages mapped on the shared zero frame */
+   unsigned long cow;       /* copy-on-write breaks */
+   unsigned long pwc_hit;   /* page walks served by the walk cache */
+   unsigned long pwc_miss;  /* page walks through every directory */
+   unsigned long fault;     /* faults served: swap-in and copy-on-write */
+   unsigned long thp_map;     /* spans mapped as huge pages up front */
+   unsigned long thp_promote; /* spans collapsed into huge pages */
+   unsigned long thp_demote;  /* huge pages split back into pages */
+   unsigned long rg_alloc;  /* regions allocated */
+   unsigned long rg_reuse;  /* part of rg_alloc served by the free bins */
+   unsigned long rg_free;   /* regions freed */
+   unsigned long rg_merge;  /* free regions coalesced with a neighbour */
+   unsigned long xlc_hit;   /* accesses served by the translation cache */
+   unsigned long xlc_miss;  /* accesses through the page table */
+};
+
+typedef uint64_t pte_t;
+
+/*
+ * Paging geometry, shifts and masks derived from the page size and the
+ * CPU bus width once at startup
+ */
+struct paging_geom_struct {
+   int pagesz;
+   int page_shift;
+   int bus_width;
+   uint32_t offst_mask; /* offset bits of a virtual address */
+   uint32_t pgn_mask;   /* page number bits of a virtual address */
+   int max_pgn;
+   int pt_levels;       /* radix page table levels, see mm-pgtbl.c */
+};
+
+/* Radix page table, PAGING_PT_BITS of the page number per level */
+#define PAGING_PT_BITS 6
+#define PAGING_PT_ENTRIES (1 << PAGING_PT_BITS)
+#define PAGING_PWC_ENTRIES 8 /* leaves remembered by the page walk cache */
+
+/*
+ * Page table leaf, the last level of the radix page table
+ */
+struct pt_leaf_struct {
+   pte_t pte[PAGING_PT_ENTRIES];
+
+   /* Swap slot still holding a valid copy of an online page, -1 if none */
+   int swpslot[PAGING_PT_ENTRIES];
+};
+
+/*
+ * Page table directory, points to directories of the next level or to
+ * leaves at the last directory level
+ */
+struct pt_dir_struct {
+   void *slot[PAGING_PT_ENTRIES];
+};
+
+struct pwc_entry_struct {
+   int tag; /* page number >> PAGING_PT_BITS, -1 if invalid */
+   struct pt_leaf_struct *leaf;
 };
 
 /* 
  * Memory management struct
  */
 struct mm_struct {
-   uint32_t *pgd;
+   /* Root directory of the page table, see mm-pgtbl.c */
+   struct pt_dir_struct *pgd;
+   int pt_nr_dirs;
+   int pt_nr_leaves;
+   struct pwc_entry_struct pwc[PAGING_PWC_ENTRIES];
 
+   /* Online PTEs of this mm in the IPT (IPT mode only), so that walking
+    * or freeing them never scans the address space */
+   struct ipt_entry_struct *ipt_list;
+
+   /* Memory areas in address order, balanced interval tree of them and
+    * their index by ID, see mm-vma.c */
    struct vm_area_struct *mmap;
+   struct vm_area_struct *vma_root;
+   struct vm_area_struct *vmatbl[PAGING_MAX_VMA];
+   int map_count;
 
-   /* Currently we support a fixed number of symbol */
-   struct vm_rg_struct symrgtbl[PAGING_MAX_SYMTBL_SZ];
+   /* Symbol table, regions by ID: a dense vector of the low IDs grown by
+    * doubling and a hash of the sparse ones, see mm-symtbl.c */
+   struct vm_rg_struct *symrgtbl;
+   int symrg_cap;
+   struct vm_symrg_struct **symrg_hash;
+   int symrg_hash_shift; /* log2 of the bucket count, 0 until first used */
+   int symrg_nr_hash;
 
    /* list of free page */
    struct pgn_t *fifo_pgn;
+
+   /* Current swap readahead window, in pages */
+   int ra_win;
+
+   /* TLB address space id, generation in the bits above CPUTLB_ASID_BITS */
+   uint64_t asid;
+
+   /* TLBs that may cache this mm, bit TLB_MASK_BIT(tlb->id) */
+   uint64_t tlb_mask;
+
+   /* Huge pages mapped, TLBs only probe huge entries when non zero */
+   int nr_hpage;
+
+#ifdef MM_XLATE_CACHE
+   /* Translation cache of the owner pcb, entries dropped under the lock */
+   struct xlate_entry_struct *xlc;
+#endif
+
+   struct mm_stat_struct stat;
+
+   /* Serializes page table, fifo and stat updates of this mm, see MM_LOCKP */
+   pthread_mutex_t lock;
+};
+
+/*
+ * Shootdown posted to a TLB, dropped by its owner before the next lookup
+ */
+struct tlb_inval_struct {
+   uint64_t asid;
+   int vpn_start;
+   int vpn_end;
+};
+
+/*
+ * Two level TLB: an optional fully associative L1 in front of the set
+ * associative L2, entry i of L2 set s is at s * nways + i
+ */
+struct tlb_struct {
+   int l1_nents;         /* L1 entries, 0 if there is no L1 */
+   uint64_t *l1_tag;
+   int *l1_pfn;
+   unsigned long *l1_lru;
+
+   int nsets;
+   int nways;
+   uint64_t *tag;        /* TLB_TAG(asid, vpn), 0 when invalid */
+   int *pfn;             /* frame number, TLB_PFN_* flags */
+   unsigned long *lru;   /* last use stamp */
+   unsigned long clock;  /* use stamp source */
+   uint64_t asid_gen;    /* ASID generation the entries belong to */
+
+   /* Only the owner CPU touches the entries, other CPUs post shootdowns */
+   struct tlb_inval_struct *inval; /* CPUTLB_INVAL_SLOTS pending ones */
+   unsigned long inval_head; /* next slot posted, under inval_lock */
+   unsigned long inval_tail; /* next slot drained by the owner */
+   int inval_all;            /* ring overflowed, drop every entry */
+   pthread_mutex_t inval_lock; /* serializes the posting CPUs only */
+   unsigned long active;     /* odd while the owner accesses through it */
+
+   int id;                   /* index in the shootdown registry */
+   struct tlb_struct *next;  /* next registered TLB */
+
+   unsigned long nr_hit;
+   unsigned long nr_l1_hit;    /* part of nr_hit served by the L1 */
+   unsigned long nr_miss;
+   unsigned long latency;      /* translation cycles, see tlb_latency */
+   unsigned long nr_pf_issued; /* entries filled by the prefetcher */
+   unsigned long nr_pf_useful; /* prefetched entries hit before eviction */
+   unsigned long nr_flush;
+   unsigned long nr_shootdown; /* shootdown requests received */
+   unsigned long nr_inval;     /* entries dropped by shootdowns */
 };
 
 struct tlb_property_struct {
@@ -71,15 +288,113 @@ struct tlb_property_struct {
 struct framephy_struct { 
    int fpn;
    struct framephy_struct *fp_next;
+   int free_next; /* next free frame + 1 in the lock-free pool, 0 ends it */
 
    /* Resereed for tracking allocated framed */
    struct mm_struct* owner;
+   int pgn; /* page of the owner mapped on this frame */
+   int mapcount; /* number of PTEs mapping this frame */
+};
+
+/*
+ * Compressed swap cache (zswap) entry and pool
+ */
+struct zswap_entry_struct {
+   int swpfpn;      /* MEMSWP frame the page belongs to */
+   int len;         /* compressed length in bytes */
+   int same_filled; /* whole page is data[0] repeated */
+   BYTE *data;
+   struct zswap_entry_struct *lru_prev;
+   struct zswap_entry_struct *lru_next;
+};
+
+struct zswap_struct {
+   struct memphy_struct *mswp; /* backing swap device */
+   struct zswap_entry_struct **tree; /* indexed by MEMSWP frame */
+   int maxfp;
+
+   /* Oldest entry at the tail is written back first */
+   struct zswap_entry_struct *lru_head;
+   struct zswap_entry_struct *lru_tail;
+
+   long pool_sz;   /* pool budget in bytes */
+   long pool_used;
+   int nr_stored;
+   pthread_mutex_t lock;
+
+   /* Page sized scratch buffers, used under the lock */
+   BYTE *page;
+   BYTE *buf;
+
+   unsigned long nr_store;
+   unsigned long nr_same_filled;
+   unsigned long nr_reject;
+   unsigned long nr_load;
+   unsigned long nr_writeback;
 };
 
+/*
+ * Inverted page table entry, the PTE of one online page of any mm
+ */
+struct ipt_entry_struct {
+   struct mm_struct *mm;
+   int pgn;
+   pte_t pte;
+   int swpslot; /* retained swap slot, moves with the PTE */
+   struct ipt_entry_struct *next;
+
+   /* Entries of the same mm, guarded by its lock, see mm->ipt_list */
+   struct ipt_entry_struct *mm_prev;
+   struct ipt_entry_struct *mm_next;
+};
+
+#define IPT_LOCK_STRIPES 64
+
+/*
+ * System wide inverted page table hashed on (mm, page), one bucket and one
+ * preallocated entry per MEMRAM frame. Swapped PTEs stay in the radix
+ * table of their mm.
+ */
+struct ipt_struct {
+   int nbuckets;
+   struct ipt_entry_struct **bucket;
+   /* Bucket chains are guarded by stripe bucket % IPT_LOCK_STRIPES */
+   pthread_mutex_t lock[IPT_LOCK_STRIPES];
+
+   struct ipt_entry_struct *free_list;
+   pthread_mutex_t free_lock;
+   int nr_entries; /* allocated entries, more than nbuckets once shared
+                    * frames (zero page, merged pages) are mapped */
+   int nr_used;
+   int nr_peak;    /* most entries used at once */
+
+   unsigned long nr_lookup;
+   unsigned long nr_probe; /* chain entries read by the lookups */
+};
+
+/*
+ * Huge page pool, the aligned frame runs at the top of MEMRAM. A run is
+ * handed out whole as a huge page, or frame by frame once the free pool
+ * of MEMRAM is empty. Frames of the pool always return to it.
+ */
+struct hpage_pool_struct {
+   int base_fpn;   /* first frame of the pool */
+   int nr_blocks;  /* frame runs of PAGING_HPAGE_NR frames */
+   uint64_t *used; /* allocated frames of each run, one bit per frame */
+   int nr_free;    /* runs with no frame allocated */
+   pthread_mutex_t lock;
+
+   unsigned long nr_alloc; /* runs handed out as huge pages */
+   unsigned long nr_fail;  /* huge page requests found no free run */
+   unsigned long nr_split; /* free runs broken up for single frames */
+};
+
+#define MEMPHY_FRMLOCK_STRIPES 64
+
 struct memphy_struct {
    /* Basic field of data and size */
    BYTE *storage;
-   int maxsz;
+   paddr_t maxsz;
    
    // /* Our group's code */
    // struct tlb_property_struct *TLB; 
@@ -87,11 +402,32 @@ struct memphy_struct {
 
    /* Sequential device fields */ 
    int rdmflg;
-   int cursor;
+   paddr_t cursor;
+   pthread_mutex_t csr_lock; /* one head, shared by every CPU */
+   unsigned long nr_seek;
+   unsigned long seek_dist; /* bytes the head traveled on seeks */
+   unsigned long nr_xfer;   /* bytes transferred */
+   unsigned long latency;   /* simulated cost of seeks and transfers */
    int pid_hold;
    /* Management structure */
-   struct framephy_struct *free_fp_list;
+   struct framephy_struct *frmtbl; /* frame table, indexed by fpn */
+   int maxfp;
+   int free_fp_cnt;
+   /* Lock-free stack of free frames: bump tag in the high 32 bits,
+    * top frame + 1 in the low 32 bits (0 if empty) */
+   uint64_t free_fp_head;
+   /* Frame descriptors are guarded by stripe fpn % MEMPHY_FRMLOCK_STRIPES */
+   pthread_mutex_t frmlock[MEMPHY_FRMLOCK_STRIPES];
    struct framephy_struct *used_fp_list;
+
+   /* Compressed cache in front of a swap device, NULL if none */
+   struct zswap_struct *zswap;
+
+   /* Shared read-only zero frame, -1 if none */
+   int zero_fpn;
+
+   /* Huge page frame runs, NULL if none */
+   struct hpage_pool_struct *hpool;
 };
 
 #endif
@@ -15,30 +15,91 @@
 #include "mm.h"
 #include <stdio.h>
 #include <stdlib.h>
-#include <unistd.h>
+#include <string.h>
 
-int tlb_change_all_page_tables_of(struct pcb_t *proc,
-                                  struct memphy_struct *mp) {
+#ifdef CPU_TLB
+
+int tlb_change_all_page_tables_of(struct pcb_t *proc, struct tlb_struct *tlb) {
   /* TODO update all page table directory info
    *      in flush or wipe TLB (if needed)
    */
-  int checking_flush = tlb_flush_tlb_of(proc, mp);
+  int checking_flush = tlb_flush_tlb_of(proc, tlb);
   return checking_flush;
 }
 
-int tlb_flush_tlb_of(struct pcb_t *process, struct memphy_struct *memory) {
-  /* TODO flush tlb cached*/
-
-  if (memory == NULL) {
+/*tlb_flush_tlb_of - invalidate every TLB entry
+ *@process: process switching in
+ *@tlb: TLB of the calling CPU
+ */
+int tlb_flush_tlb_of(struct pcb_t *process, struct tlb_struct *tlb) {
+  if (tlb == NULL) {
     return -1;
   }
-  int tlb_size = memory->maxsz;
-  for (int index = 0; index < tlb_size; index++) {
-    memory->storage[index] = -1;
-  }
+  memset(tlb->tag, 0, tlb->nsets * tlb->nways * sizeof(uint64_t));
+  if (tlb->l1_nents > 0)
+    memset(tlb->l1_tag, 0, tlb->l1_nents * sizeof(uint64_t));
+  tlb->nr_flush++;
   return 0;
 }
 
+#ifdef CPU_CYCLE_MODEL
+/*tlb_charge_access - charge the simulated cost of one memory access
+ *@proc: process doing the access
+ *@level: TLB level the translation was found in, -1 on a miss
+ *@swpin: swapped in page count of the mm before the access
+ *@reclaim: reclaimed page count of the mm before the access
+ */
+static void tlb_charge_access(struct pcb_t *proc, int level,
+                              unsigned long swpin, unsigned long reclaim) {
+  proc->cycles += tlb_latency(proc->tlb, level);
+  proc->cycles += CYCLE_RAM;
+  proc->cycles += (proc->mm->stat.swpin - swpin) * CYCLE_SWAP_IN;
+  proc->cycles += (proc->mm->stat.reclaim - reclaim) * CYCLE_SWAP_OUT;
+}
+#endif
+
+#ifdef CPUTLB_PREFETCH
+/*tlb_prefetch - fill the TLB ahead of a strided stream of misses
+ *@proc: process which missed the TLB, its mm lock is held
+ *@pgnum: page number which missed
+ *
+ * Once two misses in a row are the same VPN stride apart, the next
+ * CPUTLB_PREFETCH pages along the stride are filled if they are online.
+ * The prefetcher never faults a page in.
+ */
+void tlb_prefetch(struct pcb_t *proc, int pgnum) {
+  int stride = pgnum - proc->tlb_pf_vpn;
+  int i, vpn;
+  pte_t pte;
+
+  if (proc->tlb_pf_vpn < 0 || stride == 0) {
+    proc->tlb_pf_vpn = pgnum;
+    return;
+  }
+  proc->tlb_pf_vpn = pgnum;
+  if (stride != proc->tlb_pf_stride) {
+    proc->tlb_pf_stride = stride;
+    return;
+  }
+
+  for (i = 1; i <= CPUTLB_PREFETCH; i++) {
+    vpn = pgnum + i * stride;
+    if (vpn < 0 || vpn >= PAGING_MAX_PGN)
+      break;
+
+    pte = pte_get(proc->mm, vpn);
+    /* A page read ahead keeps its first touch for the readahead stats,
+     * a huge page is cached whole on its own miss */
+    if (!PAGING_PAGE_ONLINE(pte) ||
+        (pte & (PAGING_PTE_RAHEAD_MASK | PAGING_PTE_HUGE_MASK)))
+      continue;
+
+    tlb_cache_prefetch(proc, proc->tlb, vpn, PAGING_FPN(pte),
+                       PAGING_PAGE_WRITABLE(pte));
+  }
+}
+#endif
+
 /*tlballoc - CPU TLB-based allocate a region memory
  *@proc:  Process executing the instruction
  *@size: allocated size
@@ -62,10 +123,13 @@ int tlballoc(struct pcb_t *process, uint32_t allocation_size,
   int i = 0;
 
   while (i < num_pages){
-    uint32_t *frame_number = malloc(sizeof(uint32_t));
-    pg_getpage(process->mm, page_number + i, (int *)frame_number, process);
-    tlb_cache_write(process, process->tlb, process->pid, (page_number + i),
-                    *frame_number);
+    int frame_number;
+    pthread_mutex_lock(MM_LOCKP(process->mm));
+    if (pg_getpage(process->mm, page_number + i, &frame_number, process) == 0)
+      tlb_cache_write(
+          process, process->tlb, page_number + i, frame_number,
+          PAGING_PAGE_WRITABLE(pte_get(process->mm, page_number + i)));
+    pthread_mutex_unlock(MM_LOCKP(process->mm));
     i++;
   }
   return result;
@@ -77,25 +141,23 @@ int tlballoc(struct pcb_t *process, uint32_t allocation_size,
  *@reg_index: memory region ID (used to identify variable in symbole table)
  */
 int tlbfree_data(struct pcb_t *process, uint32_t region_index) {
-  __free(process, 0, region_index);
+  struct vm_rg_struct *region = get_symrg_byid(process->mm, region_index);
+  int start_address, end_address;
 
-  /* TODO update TLB CACHED frame num of freed page(s)*/
-  /* by using tlb_cache_read()/tlb_cache_write()*/
-  int start_address = process->mm->symrgtbl[region_index].rg_start;
-  int end_address = process->mm->symrgtbl[region_index].rg_end;
-  int region_size = end_address - start_address;
-  int page_number = PAGING_PGN(start_address);
-  int aligned_deallocate_size = PAGING_PAGE_ALIGNSZ(region_size);
-  int number_of_freed_pages = aligned_deallocate_size / PAGING_PAGESZ;
+  if (region == NULL)
+    return -1;
 
-  int i = 0;
+  /* __free clears the symbol entry, read its bounds first */
+  start_address = region->rg_start;
+  end_address = region->rg_end - 1; /* last byte */
+  __free(process, 0, region_index);
 
-  while (i < number_of_freed_pages){
-    uint32_t *frame_number = malloc(sizeof(uint32_t));
-    pg_getpage(process->mm, page_number + i, (int *)frame_number, process);
-    tlb_cache_write(process, process->tlb, process->pid, (page_number + i),
-                    *frame_number);
-    i++;
+  /* Drop the cached translations of the freed page(s) in one shootdown */
+  if (start_address <= end_address) {
+    pthread_mutex_lock(MM_LOCKP(process->mm));
+    tlb_shootdown(process->mm, PAGING_PGN(start_address),
+                  PAGING_PGN(end_address) + 1);
+    pthread_mutex_unlock(MM_LOCKP(process->mm));
   }
   return 0;
 }
@@ -105,46 +167,46 @@ int tlbfree_data(struct pcb_t *process, uint32_t region_index) {
  *@source: index of source register
  *@offset: source address = [source] + [offset]
  *@destination: destination storage
+ *
+ * A TLB hit reads MEMRAM directly, a miss walks the page table once
+ * through __read, which refills the TLB
  */
 int tlbread(struct pcb_t *process, uint32_t source_region, uint32_t byte_offset,
             uint32_t destination_region) {
+  struct vm_rg_struct *region = get_symrg_byid(process->mm, source_region);
+  BYTE data = 0;
+  int read_status = 0, tlb_level;
 
-  BYTE data, frame_number = -1;
+  if (region == NULL)
+    return -1;
+
+#ifdef CPU_CYCLE_MODEL
+  unsigned long swpin = process->mm->stat.swpin;
+  unsigned long reclaim = process->mm->stat.reclaim;
+#endif
+
+  tlb_level = tlb_cache_access(process, process->tlb,
+                               region->rg_start + byte_offset, &data, 0);
+  if (tlb_level < 0)
+    read_status = __read(process, 0, source_region, byte_offset, &data);
+  if (read_status < 0)
+    return read_status; /* nothing was read */
 
-  /* TODO retrieve TLB CACHED frame num of accessing page(s)*/
-  /* by using tlb_cache_read()/tlb_cache_write()*/
-  /* frame_number is return value of tlb_cache_read/write value*/
-
-  int start_address =
-      process->mm->symrgtbl[source_region].rg_start + byte_offset;
-  int page_number = PAGING_PGN(start_address);
-  // int frame_num_from_desired_page = -1;
-  // pg_getpage(process->mm, page_number, &frame_num_from_desired_page, process);
-  BYTE frame_number_retrieved_from_tlb = 0;
-  frame_number = tlb_cache_read(process, process->tlb, process->pid,
-                                page_number, &frame_number_retrieved_from_tlb);
-
-  usleep(10);
 #ifdef IODUMP
-  if (frame_number >= 0  /*frame_number == frame_num_from_desired_page*/)
-    printf("TLB hit at read region=%d offset=%d\n", source_region, byte_offset);
-  else{
-    printf("TLB miss at read region=%d offset=%d\n", source_region,
-           byte_offset);
-  }  
+  if (tlb_level > 0)
+    printf("TLB L%d hit at read region=%d offset=%d value=%d\n", tlb_level,
+           source_region, byte_offset, data);
+  else
+    printf("TLB miss at read region=%d offset=%d value=%d\n", source_region,
+           byte_offset, data);
 #ifdef PAGETBL_DUMP
   print_pgtbl(process, 0, -1); // print max TBL
 #endif
   MEMPHY_dump(process->mram);
 #endif
-  usleep(10);
-  int read_status = __read(process, 0, source_region, byte_offset, &data);
-  /* TODO update TLB CACHED with frame num of recent accessing page(s)*/
-  /* by using tlb_cache_read()/tlb_cache_write()*/
-
-  int frame_page_number;
-  pg_getpage(process->mm, page_number, &frame_page_number, process);
-  tlb_cache_write(process, process->tlb, process->pid, page_number, frame_page_number);
+#ifdef CPU_CYCLE_MODEL
+  tlb_charge_access(process, tlb_level, swpin, reclaim);
+#endif
   return read_status;
 }
 
@@ -153,48 +215,47 @@ int tlbread(struct pcb_t *process, uint32_t source_region, uint32_t byte_offset,
  *@data: data to be wrttien into memory
  *@destination: index of destination register
  *@offset: destination address = [destination] + [offset]
+ *
+ * Only a writable TLB entry is a hit, the first store to a page walks
+ * through __write to mark it dirty or break its copy-on-write
  */
 int tlbwrite(struct pcb_t *process, BYTE data, uint32_t destination_region,
              uint32_t byte_offset) {
-  int write_status;
-  BYTE frame_number = -1;
-  // int result = tlb_cache_read(process->mram, process->pid, destination_region
-  // + byte_offset, &frame_number);
-  /* TODO retrieve TLB CACHED frame num of accessing page(s))*/
-  /* by using tlb_cache_read()/tlb_cache_write()
-  frame_number is return value of tlb_cache_read/write value*/
-
-  int start_address = process->mm->symrgtbl[destination_region].rg_start + byte_offset;
-  int page_number = PAGING_PGN(start_address);
-  // uint32_t page_entry = process->mm->pgd[page_number];
-  // int frame_num_from_desired_page = PAGING_FPN(page_entry);
-  BYTE frame_number_retrieved_from_tlb = 0;
-  frame_number = tlb_cache_read(process, process->tlb, process->pid, page_number, &frame_number_retrieved_from_tlb);
-
-  usleep(10);
+  struct vm_rg_struct *region =
+      get_symrg_byid(process->mm, destination_region);
+  int write_status = 0, tlb_level;
+
+  if (region == NULL)
+    return -1;
+
+#ifdef CPU_CYCLE_MODEL
+  unsigned long swpin = process->mm->stat.swpin;
+  unsigned long reclaim = process->mm->stat.reclaim;
+#endif
+
+  tlb_level = tlb_cache_access(process, process->tlb,
+                               region->rg_start + byte_offset, &data, 1);
+  if (tlb_level < 0)
+    write_status = __write(process, 0, destination_region, byte_offset, data);
+
 #ifdef IODUMP
-  if (frame_number >= 0  /*frame_number == frame_num_from_desired_page*/)
-    printf("TLB hit at write region=%d offset=%d value=%d\n",
+  if (tlb_level > 0)
+    printf("TLB L%d hit at write region=%d offset=%d value=%d\n", tlb_level,
            destination_region, byte_offset, data);
-  else{
+  else
     printf("TLB miss at write region=%d offset=%d value=%d\n",
            destination_region, byte_offset, data);
-  }
 #ifdef PAGETBL_DUMP
   print_pgtbl(process, 0, -1); // print max TBL;
 #endif
   MEMPHY_dump(process->mram);
 #endif
-  /* TODO update TLB CACHED with frame num of recent accessing page(s)*/
-  /* by using tlb_cache_read()/tlb_cache_write()*/
-  usleep(10);
-  write_status = __write(process, 0, destination_region, byte_offset, data);
-
-  int frame_page_number;
-  pg_getpage(process->mm, page_number, &frame_page_number, process);
-  tlb_cache_write(process, process->tlb, process->pid, page_number, frame_page_number);
+#ifdef CPU_CYCLE_MODEL
+  tlb_charge_access(process, tlb_level, swpin, reclaim);
+#endif
 
   return write_status;
 }
 
-// #endif
\ No newline at end of file
+#endif
+// #endif
@@ -8,180 +8,827 @@
  */
 //#ifdef MM_TLB
 /*
- * Memory physical based TLB Cache
+ * Two level TLB Cache
  * TLB cache module tlb/tlbcache.c
  *
- * TLB cache is physically memory phy
- * supports random access
- * and runs at high speed
+ * Every entry holds a 64-bit tag (valid bit, ASID, VPN) and the full
+ * frame number. The L2 is set associative, the ways of a set are stored
+ * contiguously so the whole set is tag compared at once. The optional L1
+ * is a small fully associative TLB searched the same way. Both levels
+ * replace LRU by use stamp, an L2 hit is promoted into the L1 and a
+ * refill goes to both levels. Prefetched entries only go to the L2.
+ *
+ * Entries are tagged with the ASID of their mm, so a context switch needs
+ * no flush. When the ASIDs run out a new generation starts, mms get new
+ * ASIDs on their next access and each TLB is flushed once, lazily, the
+ * first time it is used in the new generation.
+ *
+ * Every CPU owns a private TLB and is the only one to touch its entries,
+ * so lookups and fills take no lock. Other CPUs post their shootdowns to
+ * a small ring of the TLB, the owner drains it before each lookup or
+ * fill. A full ring makes the owner drop every entry instead.
+ *
+ * A huge page takes a single entry, its tag holds the huge page number
+ * with TLB_TAG_HUGE set and its frame number is the first of the run.
+ * Huge entries share both levels with the others and are only probed
+ * after a miss on the page itself, for an mm mapping huge pages.
+ *
+ * A page unmapped or remapped is shot down from every TLB that may cache
+ * its mm (mm->tlb_mask) before its frame is copied out or reused. The
+ * owner keeps tlb->active odd from a lookup to the end of its memory
+ * access, the shooting CPU waits for an access in flight to end, so no
+ * access goes through a stale entry once the shootdown returns. Entries
+ * are only filled under the mm lock, which the shooting CPU holds, so no
+ * stale translation can be refilled meanwhile.
  */
 
 #include "mm.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <unistd.h>
-#define init_tlbcache(mp, sz, ...) init_memphy(mp, sz, (1, ##__VA_ARGS__))
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef CPU_TLB
+
+static pthread_mutex_t asid_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t asid_generation = 1;
+static uint64_t asid_next = 1;
+static unsigned long asid_rollover = 0;
 
-pthread_mutex_t tlb_lock;
-pthread_mutex_t pid_lock;
+/* Registry of every TLB, only grown before the CPUs start */
+static pthread_mutex_t tlb_list_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct tlb_struct *tlb_list = NULL;
+static int tlb_nr = 0;
+static unsigned long shootdown_req = 0;
 
 /*
- *  tlb_cache_read read TLB cache device
- *  @mp: memphy struct
- *  @pid: process id
- *  @pgnum: page number
- *  @value: obtained value
+ *  tlb_get_asid - get the current ASID of an mm
+ *  @mm: address space
+ *
+ *  Return the ASID with its generation in the upper bits, a new one is
+ *  assigned if the mm still holds one of a past generation
  */
+uint64_t tlb_get_asid(struct mm_struct *mm) {
+  uint64_t asid = __atomic_load_n(&mm->asid, __ATOMIC_ACQUIRE);
 
-int tlb_cache_read(struct pcb_t *proc, struct memphy_struct *mp, int pid,
-                   int pgnum, BYTE *value) {
-  /* TODO: the identify info is mapped to
-   *      cache line by employing:
-   *      direct mapped, associated mapping etc.
-   */
-  if (mp == NULL) {
-    return -1;
+  if (TLB_ASID_GEN(asid) ==
+      __atomic_load_n(&asid_generation, __ATOMIC_ACQUIRE))
+    return asid;
+
+  pthread_mutex_lock(&asid_lock);
+  asid = mm->asid;
+  if (TLB_ASID_GEN(asid) != asid_generation) {
+    if (asid_next > TLB_ASID_MASK) {
+      /* Out of ASIDs, every TLB flushes once before reusing them */
+      __atomic_add_fetch(&asid_generation, 1, __ATOMIC_RELEASE);
+      asid_next = 1;
+      asid_rollover++;
+    }
+    asid = (asid_generation << CPUTLB_ASID_BITS) | asid_next++;
+    __atomic_store_n(&mm->asid, asid, __ATOMIC_RELEASE);
   }
-  //*
-  uint32_t tlb_index = (uint32_t)pgnum % mp->maxsz;
+  pthread_mutex_unlock(&asid_lock);
+
+  return asid;
+}
 
+/*
+ *  tlb_sync_asid - get the ASID of an access and bring the TLB to its
+ *  generation
+ *  @proc: process doing the access
+ *  @tlb: TLB of the calling CPU
+ */
+static uint64_t tlb_sync_asid(struct pcb_t *proc, struct tlb_struct *tlb) {
+  uint64_t asid;
 
-  if (mp->storage[tlb_index] == -1) {
-    //* do not have that entry in tlb, fail to read
-    //* update the tlb entries outside this function
-    return -1;
+  for (;;) {
+    asid = tlb_get_asid(proc->mm);
+    if (TLB_ASID_GEN(asid) == tlb->asid_gen)
+      break;
+    if (TLB_ASID_GEN(asid) > tlb->asid_gen) {
+      /* Entries of the past generation may alias reused ASIDs */
+      tlb_change_all_page_tables_of(proc, tlb);
+      __atomic_store_n(&tlb->asid_gen, TLB_ASID_GEN(asid), __ATOMIC_RELEASE);
+      break;
+    }
+    /* A rollover happened meanwhile, the ASID is already stale */
   }
-  //* checking pid
-  pthread_mutex_lock(&pid_lock);
-  if (pid != mp->pid_hold) {
-    pthread_mutex_unlock(&pid_lock);
-    //* pid changed so that the data in tlb is not accurate anymore
-    //* therefore, flush all and conclude that it is a miss hit
-    pthread_mutex_lock(&tlb_lock); 
-    tlb_change_all_page_tables_of(proc,mp);
-    pthread_mutex_lock(&pid_lock);
-    mp->pid_hold = pid;
-    pthread_mutex_unlock(&pid_lock);
-    pthread_mutex_unlock(&tlb_lock);
-    return 0;
+
+  return asid & TLB_ASID_MASK;
+}
+
+/*
+ *  tlb_find_way - search a set for a tag
+ *  @tags: tags of the set
+ *  @nways: number of ways
+ *  @key: tag to look for
+ *
+ *  Return the matching way, -1 if none
+ */
+static int tlb_find_way(const uint64_t *tags, int nways, uint64_t key) {
+  int way = 0;
+
+#ifdef __SSE2__
+  /* Two ways per compare, a 64-bit lane matches when both halves do */
+  __m128i k = _mm_set1_epi64x((long long)key);
+
+  for (; way + 2 <= nways; way += 2) {
+    __m128i t = _mm_loadu_si128((const __m128i *)&tags[way]);
+    __m128i eq = _mm_cmpeq_epi32(t, k);
+    int mask;
+
+    eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+    mask = _mm_movemask_pd(_mm_castsi128_pd(eq));
+    if (mask)
+      return way + ((mask & 1) ? 0 : 1);
   }
-  pthread_mutex_unlock(&pid_lock);
-  TLBMEMPHY_read(mp, tlb_index, value);
-  return *value;
+#endif
+
+  for (; way < nways; way++)
+    if (tags[way] == key)
+      return way;
+
+  return -1;
 }
 
 /*
- *  tlb_cache_write write TLB cache device
- *  @mp: memphy struct
- *  @pid: process id
+ *  tlb_lookup - find the L2 entry of a page
+ *  @tlb: TLB of the calling CPU
+ *  @asid: ASID of the access
  *  @pgnum: page number
- *  @value: obtained value
- */
-int tlb_cache_write(struct pcb_t *proc, struct memphy_struct *mp, int pid,
-                    int pgnum, BYTE value) {
-  /* TODO: the identify info is mapped to
-   *      cache line by employing:
-   *      direct mapped, associated mapping etc.
-   */
-  if (mp == NULL) {
-    return -1;
+ *
+ *  Return the entry index, -1 if the page is not cached
+ */
+static int tlb_lookup(struct tlb_struct *tlb, uint64_t asid, int pgnum) {
+  int set = (uint32_t)pgnum % tlb->nsets;
+  int way = tlb_find_way(&tlb->tag[set * tlb->nways], tlb->nways,
+                         TLB_TAG(asid, pgnum));
+
+  return (way < 0) ? -1 : set * tlb->nways + way;
+}
+
+#ifdef MM_HUGEPAGE
+/*
+ *  tlb_lookup_hpage - find the L2 entry of the huge page holding a page
+ *  @tlb: TLB of the calling CPU
+ *  @asid: ASID of the access
+ *  @pgnum: page number
+ *
+ *  Return the entry index, -1 if the huge page is not cached
+ */
+static int tlb_lookup_hpage(struct tlb_struct *tlb, uint64_t asid, int pgnum) {
+  int set = ((uint32_t)pgnum >> PAGING_HPAGE_ORDER) % tlb->nsets;
+  int way = tlb_find_way(&tlb->tag[set * tlb->nways], tlb->nways,
+                         TLB_TAG_HPAGE(asid, pgnum));
+
+  return (way < 0) ? -1 : set * tlb->nways + way;
+}
+#endif
+
+/*
+ *  tlb_entry_vpn - first page covered by an entry
+ *  @tag: valid entry tag
+ */
+static int tlb_entry_vpn(uint64_t tag) {
+  if (tag & TLB_TAG_HUGE)
+    return (int)TLB_TAG_VPN(tag) << PAGING_HPAGE_ORDER;
+  return (int)TLB_TAG_VPN(tag);
+}
+
+/*
+ *  tlb_fill_way - fill a tag into a group of ways
+ *  @tags: tags of the ways
+ *  @lru: use stamps of the ways
+ *  @nways: number of ways
+ *  @key: tag to fill
+ *
+ *  Return the way holding @key, else the invalid or least recently used
+ *  one which the caller overwrites
+ */
+static int tlb_fill_way(const uint64_t *tags, const unsigned long *lru,
+                        int nways, uint64_t key) {
+  int way = tlb_find_way(tags, nways, key);
+  int idx;
+
+  if (way >= 0)
+    return way;
+
+  way = 0;
+  for (idx = 0; idx < nways; idx++) {
+    if (!(tags[idx] & TLB_TAG_VALID))
+      return idx;
+    if (lru[idx] < lru[way])
+      way = idx;
+  }
+
+  return way;
+}
+
+/*
+ *  tlb_l1_fill - install a translation in the L1
+ *  @tlb: TLB of the calling CPU
+ *  @key: tag
+ *  @pfn: entry frame number and flags
+ */
+static void tlb_l1_fill(struct tlb_struct *tlb, uint64_t key, int pfn) {
+  int idx;
+
+  if (tlb->l1_nents <= 0)
+    return;
+
+  idx = tlb_fill_way(tlb->l1_tag, tlb->l1_lru, tlb->l1_nents, key);
+  tlb->l1_tag[idx] = key;
+  tlb->l1_pfn[idx] = pfn;
+  tlb->l1_lru[idx] = ++tlb->clock;
+}
+
+/*
+ *  tlb_inval_range - drop the entries of a page range from a group of ways
+ *  @tags: tags of the ways
+ *  @nents: number of ways
+ *  @asid: ASID of the range
+ *  @vpn_start: first page
+ *  @vpn_end: page past the range
+ *
+ *  Return the number of entries dropped
+ */
+static int tlb_inval_range(uint64_t *tags, int nents, uint64_t asid,
+                           int vpn_start, int vpn_end) {
+  int idx, vpn, nr = 0;
+
+  for (idx = 0; idx < nents; idx++) {
+    uint64_t key = tags[idx];
+
+    if (!(key & TLB_TAG_VALID) || TLB_TAG_ASID(key) != asid)
+      continue;
+
+    /* A huge entry goes as soon as one of its pages is in the range */
+    vpn = tlb_entry_vpn(key);
+    if (vpn < vpn_end &&
+        vpn + ((key & TLB_TAG_HUGE) ? PAGING_HPAGE_NR : 1) > vpn_start) {
+      tags[idx] = 0;
+      nr++;
+    }
+  }
+
+  return nr;
+}
+
+/*
+ *  tlb_inval - drop the entries of a page range of an ASID
+ *  @tlb: TLB of the calling CPU
+ *  @asid: ASID of the range
+ *  @vpn_start: first page
+ *  @vpn_end: page past the range
+ */
+static void tlb_inval(struct tlb_struct *tlb, uint64_t asid, int vpn_start,
+                      int vpn_end) {
+  int vpn, idx;
+
+  if (vpn_end - vpn_start <= tlb->nsets) {
+    /* Short range, probe the set of each page */
+    for (vpn = vpn_start; vpn < vpn_end; vpn++) {
+      idx = tlb_lookup(tlb, asid, vpn);
+      if (idx >= 0) {
+        tlb->tag[idx] = 0;
+        tlb->nr_inval++;
+      }
+    }
+#ifdef MM_HUGEPAGE
+    for (vpn = PAGING_HPAGE_PGN(vpn_start); vpn < vpn_end;
+         vpn += PAGING_HPAGE_NR) {
+      idx = tlb_lookup_hpage(tlb, asid, vpn);
+      if (idx >= 0) {
+        tlb->tag[idx] = 0;
+        tlb->nr_inval++;
+      }
+    }
+#endif
+  } else {
+    tlb->nr_inval += tlb_inval_range(tlb->tag, tlb->nsets * tlb->nways, asid,
+                                     vpn_start, vpn_end);
+  }
+  if (tlb->l1_nents > 0)
+    tlb->nr_inval +=
+        tlb_inval_range(tlb->l1_tag, tlb->l1_nents, asid, vpn_start, vpn_end);
+}
+
+/*
+ *  tlb_drain - apply the shootdowns posted to a TLB
+ *  @tlb: TLB of the calling CPU
+ */
+static void tlb_drain(struct tlb_struct *tlb) {
+  unsigned long head = __atomic_load_n(&tlb->inval_head, __ATOMIC_ACQUIRE);
+  unsigned long tail = tlb->inval_tail;
+  struct tlb_inval_struct *req;
+
+  if (tail != head) {
+    for (; tail != head; tail++) {
+      req = &tlb->inval[tail % CPUTLB_INVAL_SLOTS];
+      tlb_inval(tlb, req->asid, req->vpn_start, req->vpn_end);
+    }
+    /* The slots are free for the posting CPUs again */
+    __atomic_store_n(&tlb->inval_tail, tail, __ATOMIC_RELEASE);
   }
-  pthread_mutex_lock(&pid_lock);
-  if (pid != mp->pid_hold) {
-    pthread_mutex_unlock(&pid_lock);
-    //* pid changed so that the data in tlb is not accurate anymore
-    //* therefore, flush all and conclude that it is a miss hit
-    pthread_mutex_lock(&tlb_lock);
-    tlb_change_all_page_tables_of(proc,mp);
-    pthread_mutex_lock(&pid_lock);
-    //* update pid hold
-    mp->pid_hold = pid;
-    pthread_mutex_unlock(&pid_lock);
-    pthread_mutex_unlock(&tlb_lock);
-    // usleep(100);
+
+  if (__atomic_load_n(&tlb->inval_all, __ATOMIC_ACQUIRE) &&
+      __atomic_exchange_n(&tlb->inval_all, 0, __ATOMIC_ACQ_REL))
+    tlb_flush_tlb_of(NULL, tlb);
+}
+
+/*
+ *  tlb_enter - start an access through a TLB
+ *  @tlb: TLB of the calling CPU
+ *
+ *  Pairs with the fence of tlb_shootdown: either the posted shootdown is
+ *  drained here or the shooting CPU sees the access and waits for it
+ */
+static void tlb_enter(struct tlb_struct *tlb) {
+  __atomic_add_fetch(&tlb->active, 1, __ATOMIC_SEQ_CST);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  tlb_drain(tlb);
+}
+
+/*
+ *  tlb_leave - end an access through a TLB
+ *  @tlb: TLB of the calling CPU
+ */
+static void tlb_leave(struct tlb_struct *tlb) {
+  __atomic_add_fetch(&tlb->active, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ *  tlb_latency - translation cost of an access
+ *  @tlb: TLB
+ *  @level: level the translation was found in, -1 on a miss
+ */
+unsigned long tlb_latency(struct tlb_struct *tlb, int level) {
+  unsigned long lat = CYCLE_TLB_HIT;
+
+  if (level == 1 || tlb == NULL)
+    return (level > 0) ? lat : CYCLE_TLB_MISS;
+
+  /* The L2 is only probed behind an L1 miss */
+  if (tlb->l1_nents > 0)
+    lat += CYCLE_TLB_L2_HIT;
+  if (level < 0)
+    lat += CYCLE_TLB_MISS;
+
+  return lat;
+}
+
+/*
+ *  tlb_translate - look a page up through the TLB levels
+ *  @proc: process doing the access
+ *  @tlb: TLB of the calling CPU
+ *  @pgnum: page number
+ *  @write: store access, only writable entries hit
+ *  @pfn: obtained entry frame number and flags
+ *
+ *  Return the level which hit, -1 on miss
+ */
+static int tlb_translate(struct pcb_t *proc, struct tlb_struct *tlb,
+                         int pgnum, int write, int *pfn) {
+  uint64_t asid = tlb_sync_asid(proc, tlb);
+  uint64_t tag = TLB_TAG(asid, pgnum);
+  int idx, level = -1;
+#ifdef MM_HUGEPAGE
+  int huge = __atomic_load_n(&proc->mm->nr_hpage, __ATOMIC_RELAXED) > 0;
+#endif
+
+  if (tlb->l1_nents > 0) {
+    idx = tlb_find_way(tlb->l1_tag, tlb->l1_nents, tag);
+#ifdef MM_HUGEPAGE
+    if (huge && (idx < 0 || (write && !(tlb->l1_pfn[idx] & TLB_PFN_WRITABLE))))
+      idx = tlb_find_way(tlb->l1_tag, tlb->l1_nents,
+                         TLB_TAG_HPAGE(asid, pgnum));
+#endif
+    if (idx >= 0 && (!write || (tlb->l1_pfn[idx] & TLB_PFN_WRITABLE))) {
+      tlb->l1_lru[idx] = ++tlb->clock;
+      tlb->nr_l1_hit++;
+      *pfn = tlb->l1_pfn[idx];
+      tag = tlb->l1_tag[idx];
+      level = 1;
+    }
   }
-  else{
-    pthread_mutex_unlock(&pid_lock);
+
+  if (level < 0) {
+    idx = tlb_lookup(tlb, asid, pgnum);
+#ifdef MM_HUGEPAGE
+    if (huge && (idx < 0 || (write && !(tlb->pfn[idx] & TLB_PFN_WRITABLE))))
+      idx = tlb_lookup_hpage(tlb, asid, pgnum);
+#endif
+    if (idx >= 0 && (!write || (tlb->pfn[idx] & TLB_PFN_WRITABLE))) {
+      if (tlb->pfn[idx] & TLB_PFN_PREFETCH) {
+        /* First use of a prefetched entry, a miss saved */
+        tlb->pfn[idx] &= ~TLB_PFN_PREFETCH;
+        tlb->nr_pf_useful++;
+      }
+      tlb->lru[idx] = ++tlb->clock;
+      *pfn = tlb->pfn[idx];
+      tag = tlb->tag[idx];
+      tlb_l1_fill(tlb, tag, *pfn);
+      level = 2;
+    }
   }
-  // mp->storage[address] = value;
-  uint32_t tlb_index = (uint32_t)pgnum % mp->maxsz;
-  TLBMEMPHY_write(mp, tlb_index, value);
+
+  /* A huge entry maps the first frame of the run */
+  if (level > 0 && (tag & TLB_TAG_HUGE))
+    *pfn += PAGING_HPAGE_IDX(pgnum);
+
+  if (level > 0)
+    tlb->nr_hit++;
+  else
+    tlb->nr_miss++;
+  tlb->latency += tlb_latency(tlb, level);
+
+  return level;
+}
+
+/*
+ *  tlb_cache_read read TLB cache device
+ *  @proc: process doing the access
+ *  @tlb: TLB
+ *  @pgnum: page number
+ *  @fpn: obtained frame number
+ *
+ *  Return 0 on hit, -1 on miss
+ */
+int tlb_cache_read(struct pcb_t *proc, struct tlb_struct *tlb, int pgnum,
+                   int *fpn) {
+  int pfn, level;
+
+  if (tlb == NULL || tlb->nsets <= 0)
+    return -1;
+
+  tlb_enter(tlb);
+  level = tlb_translate(proc, tlb, pgnum, 0, &pfn);
+  tlb_leave(tlb);
+
+  if (level < 0)
+    return -1;
+
+  *fpn = TLB_PFN(pfn);
   return 0;
 }
 
 /*
- *  TLBMEMPHY_read natively supports MEMPHY device interfaces
- *  @mp: memphy struct
- *  @addr: address
- *  @value: obtained value
+ *  tlb_cache_access - access memory through a cached translation
+ *  @proc: process doing the access
+ *  @tlb: TLB
+ *  @addr: virtual address
+ *  @data: byte read, or byte to write
+ *  @write: store access
+ *
+ *  A hit goes straight to MEMRAM. A store only hits a writable entry,
+ *  the first store to a page walks to set its dirty bit or break its
+ *  copy-on-write. Return the TLB level which hit, -1 on miss
+ */
+int tlb_cache_access(struct pcb_t *proc, struct tlb_struct *tlb, int addr,
+                     BYTE *data, int write) {
+  int pfn, level;
+  paddr_t phyaddr;
+
+  if (tlb == NULL || tlb->nsets <= 0)
+    return -1;
+
+  tlb_enter(tlb);
+  level = tlb_translate(proc, tlb, PAGING_PGN(addr), write, &pfn);
+  if (level < 0) {
+    tlb_leave(tlb);
+    return -1;
+  }
+
+  /* Shootdowns wait for the access to leave, the frame stays ours */
+  phyaddr = PAGING_PHYADDR(TLB_PFN(pfn), PAGING_OFFST(addr));
+  if (write)
+    MEMPHY_write(proc->mram, phyaddr, *data);
+  else
+    MEMPHY_read(proc->mram, phyaddr, data);
+  tlb_leave(tlb);
+
+  return level;
+}
+
+/*
+ *  tlb_fill - install an entry in both levels
+ *  @proc: process the entry belongs to
+ *  @tlb: TLB of the calling CPU
+ *  @key: tag
+ *  @set: L2 set of the tag
+ *  @pfn: entry frame number and flags
+ */
+static void tlb_fill(struct pcb_t *proc, struct tlb_struct *tlb, uint64_t key,
+                     int set, int pfn) {
+  int base = set * tlb->nways, idx;
+
+  __atomic_or_fetch(&proc->mm->tlb_mask, TLB_MASK_BIT(tlb->id),
+                    __ATOMIC_RELAXED);
+
+  idx = base + tlb_fill_way(&tlb->tag[base], &tlb->lru[base], tlb->nways, key);
+  tlb->tag[idx] = key;
+  tlb->pfn[idx] = pfn;
+  tlb->lru[idx] = ++tlb->clock;
+
+  tlb_l1_fill(tlb, key, pfn);
+}
+
+/*
+ *  tlb_cache_write write TLB cache device
+ *  @proc: process doing the access
+ *  @tlb: TLB
+ *  @pgnum: page number
+ *  @fpn: frame number the page is mapped on
+ *  @writable: stores may go through the entry, see PAGING_PAGE_WRITABLE
+ *
+ *  Refill the entry of the page in both levels, or the invalid/least
+ *  recently used way. Caller holds the mm lock so the entry cannot race
+ *  with a shootdown of the page
  */
-int TLBMEMPHY_read(struct memphy_struct *mp, int addr, BYTE *value) {
-  if (mp == NULL)
+int tlb_cache_write(struct pcb_t *proc, struct tlb_struct *tlb, int pgnum,
+                    int fpn, int writable) {
+  int pfn = writable ? (fpn | TLB_PFN_WRITABLE) : fpn;
+
+  if (tlb == NULL || tlb->nsets <= 0)
     return -1;
 
-  /* TLB cached is random access by native */
-  *value = mp->storage[addr];
+  /* Shootdowns posted before are older than the entry */
+  tlb_drain(tlb);
+  tlb_fill(proc, tlb, TLB_TAG(tlb_sync_asid(proc, tlb), pgnum),
+           (uint32_t)pgnum % tlb->nsets, pfn);
 
   return 0;
 }
 
 /*
- *  TLBMEMPHY_write natively supports MEMPHY device interfaces
- *  @mp: memphy struct
- *  @addr: address
- *  @data: written data
+ *  tlb_cache_write_hpage - cache a whole huge page
+ *  @proc: process doing the access
+ *  @tlb: TLB
+ *  @pgnum: page number of any page of the huge page
+ *  @fpn: frame number @pgnum is mapped on
+ *  @writable: stores may go through the entry, the pages share one
+ *  dirty bit
+ *
+ *  Caller holds the mm lock, as for tlb_cache_write
  */
-int TLBMEMPHY_write(struct memphy_struct *mp, int addr, BYTE data) {
-  if (mp == NULL)
+int tlb_cache_write_hpage(struct pcb_t *proc, struct tlb_struct *tlb, int pgnum,
+                          int fpn, int writable) {
+  int pfn = fpn - PAGING_HPAGE_IDX(pgnum);
+
+  if (tlb == NULL || tlb->nsets <= 0)
     return -1;
 
-  /* TLB cached is random access by native */
-  mp->storage[addr] = data;
+  if (writable)
+    pfn |= TLB_PFN_WRITABLE;
+
+  tlb_drain(tlb);
+  tlb_fill(proc, tlb, TLB_TAG_HPAGE(tlb_sync_asid(proc, tlb), pgnum),
+           ((uint32_t)pgnum >> PAGING_HPAGE_ORDER) % tlb->nsets, pfn);
+
   return 0;
 }
 
 /*
- *  TLBMEMPHY_format natively supports MEMPHY device interfaces
- *  @mp: memphy struct
+ *  tlb_cache_prefetch - fill the L2 TLB ahead of use
+ *  @proc: process the page belongs to
+ *  @tlb: TLB
+ *  @pgnum: page number
+ *  @fpn: frame number the page is mapped on
+ *  @writable: stores may go through the entry
+ *
+ *  A page already cached is left alone. Caller holds the mm lock
  */
+int tlb_cache_prefetch(struct pcb_t *proc, struct tlb_struct *tlb, int pgnum,
+                       int fpn, int writable) {
+  uint64_t key;
+  int base, idx;
 
-int TLBMEMPHY_dump(struct memphy_struct *mp) {
-  /*TODO dump memphy contnt mp->storage
-   *     for tracing the memory content
-   */
-  if (!mp || !mp->storage) {
+  if (tlb == NULL || tlb->nsets <= 0)
     return -1;
+
+  tlb_drain(tlb);
+  key = TLB_TAG(tlb_sync_asid(proc, tlb), pgnum);
+  if (tlb_lookup(tlb, TLB_TAG_ASID(key), pgnum) >= 0)
+    return 0;
+  __atomic_or_fetch(&proc->mm->tlb_mask, TLB_MASK_BIT(tlb->id),
+                    __ATOMIC_RELAXED);
+
+  base = ((uint32_t)pgnum % tlb->nsets) * tlb->nways;
+  idx = base + tlb_fill_way(&tlb->tag[base], &tlb->lru[base], tlb->nways, key);
+  tlb->tag[idx] = key;
+  tlb->pfn[idx] = fpn | TLB_PFN_PREFETCH | (writable ? TLB_PFN_WRITABLE : 0);
+  tlb->lru[idx] = ++tlb->clock;
+  tlb->nr_pf_issued++;
+
+  return 0;
+}
+
+/*
+ *  tlb_shootdown - invalidate a range of pages of an mm in every TLB
+ *  @mm: address space, locked by the caller
+ *  @vpn_start: first page
+ *  @vpn_end: page past the range
+ *
+ *  The range is posted once to each TLB which filled entries of @mm, its
+ *  owner drops them before its next lookup. Return once no access can go
+ *  through the dropped entries anymore
+ */
+int tlb_shootdown(struct mm_struct *mm, int vpn_start, int vpn_end) {
+  struct tlb_struct *tlb;
+  struct tlb_inval_struct *req;
+  uint64_t asid, mask;
+  unsigned long head, active;
+
+  asid = __atomic_load_n(&mm->asid, __ATOMIC_ACQUIRE);
+  mask = __atomic_load_n(&mm->tlb_mask, __ATOMIC_ACQUIRE);
+  if (asid == 0 || mask == 0 || vpn_start >= vpn_end)
+    return 0;
+
+  __atomic_add_fetch(&shootdown_req, 1, __ATOMIC_RELAXED);
+  for (tlb = __atomic_load_n(&tlb_list, __ATOMIC_ACQUIRE); tlb != NULL;
+       tlb = tlb->next) {
+    if (!(mask & TLB_MASK_BIT(tlb->id)))
+      continue;
+
+    /* A TLB of another generation is flushed before its next lookup */
+    if (__atomic_load_n(&tlb->asid_gen, __ATOMIC_ACQUIRE) !=
+        TLB_ASID_GEN(asid))
+      continue;
+
+    pthread_mutex_lock(&tlb->inval_lock);
+    head = tlb->inval_head;
+    if (head - __atomic_load_n(&tlb->inval_tail, __ATOMIC_ACQUIRE) >=
+        CPUTLB_INVAL_SLOTS) {
+      __atomic_store_n(&tlb->inval_all, 1, __ATOMIC_RELEASE);
+    } else {
+      req = &tlb->inval[head % CPUTLB_INVAL_SLOTS];
+      req->asid = asid & TLB_ASID_MASK;
+      req->vpn_start = vpn_start;
+      req->vpn_end = vpn_end;
+      __atomic_store_n(&tlb->inval_head, head + 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&tlb->inval_lock);
+    __atomic_add_fetch(&tlb->nr_shootdown, 1, __ATOMIC_RELAXED);
+
+    /* Pairs with tlb_enter, wait for an access in flight to leave */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    active = __atomic_load_n(&tlb->active, __ATOMIC_SEQ_CST);
+    if (active & 1)
+      while (__atomic_load_n(&tlb->active, __ATOMIC_ACQUIRE) == active)
+        ; /* a single byte access, never blocks */
   }
 
-  printf("---TLB MEM DUMP---\n");
-  uint32_t *word_storage = (uint32_t *)mp->storage;
-  // printf("%d\n", mp->maxsz);
-  int i;
-  for (i = 0; i < mp->maxsz / 4; i++)
-    if (word_storage[i] != -1)
-      // printf("%d : %d\n", i, word_storage[i]);
-      printf("%08x: %08x\n", i * 4, word_storage[i]);
   return 0;
 }
 
 /*
- *  Init TLBMEMPHY struct
+ *  TLB_dump - dump the valid TLB entries
+ *  @tlb: TLB
+ */
+int TLB_dump(struct tlb_struct *tlb) {
+  int idx;
+
+  if (tlb == NULL || tlb->tag == NULL)
+    return -1;
+
+  printf("---TLB DUMP---\n");
+  for (idx = 0; idx < tlb->l1_nents; idx++)
+    if (tlb->l1_tag[idx] & TLB_TAG_VALID)
+      printf("L1 entry %d: asid %d vpn %d -> fpn %d%s\n", idx,
+             (int)TLB_TAG_ASID(tlb->l1_tag[idx]),
+             tlb_entry_vpn(tlb->l1_tag[idx]), TLB_PFN(tlb->l1_pfn[idx]),
+             (tlb->l1_tag[idx] & TLB_TAG_HUGE) ? " huge" : "");
+  for (idx = 0; idx < tlb->nsets * tlb->nways; idx++)
+    if (tlb->tag[idx] & TLB_TAG_VALID)
+      printf("L2 set %d way %d: asid %d vpn %d -> fpn %d%s\n",
+             idx / tlb->nways, idx % tlb->nways,
+             (int)TLB_TAG_ASID(tlb->tag[idx]), tlb_entry_vpn(tlb->tag[idx]),
+             TLB_PFN(tlb->pfn[idx]),
+             (tlb->tag[idx] & TLB_TAG_HUGE) ? " huge" : "");
+  return 0;
+}
+
+/*
+ *  tlb_reach - memory covered by a group of ways
+ *  @tags: tags of the ways
+ *  @nents: number of ways
+ *  @nr_huge: return the number of huge entries
  */
-int init_tlbmemphy(struct memphy_struct *mp, int max_size) {
+static unsigned long tlb_reach(const uint64_t *tags, int nents, int *nr_huge) {
+  unsigned long reach = 0;
+  int idx;
 
-  mp->storage = (BYTE *)malloc(max_size * sizeof(BYTE));
-  int i = 0;
-  while (i < max_size) {
-    mp->storage[i] = -1;
-    i++;
+  *nr_huge = 0;
+  for (idx = 0; idx < nents; idx++) {
+    if (!(tags[idx] & TLB_TAG_VALID))
+      continue;
+    if (tags[idx] & TLB_TAG_HUGE) {
+      reach += PAGING_HPAGESZ;
+      (*nr_huge)++;
+    } else {
+      reach += PAGING_PAGESZ;
+    }
   }
-  mp->maxsz = max_size;
-  mp->pid_hold = -1;
-  mp->rdmflg = 1;
-  pthread_mutex_init(&tlb_lock, NULL);
-  pthread_mutex_init(&pid_lock, NULL);
+
+  return reach;
+}
+
+/*
+ *  print_tlb_stat - report the hit rate of each TLB level
+ *  @tlb: TLB
+ *  @name: owner of the TLB
+ */
+int print_tlb_stat(struct tlb_struct *tlb, const char *name) {
+  unsigned long nr_lookup, nr_l2_lookup, nr_l2_hit, l1_reach, l2_reach;
+  int l1_huge, l2_huge;
+
+  if (tlb == NULL)
+    return -1;
+
+  nr_lookup = tlb->nr_hit + tlb->nr_miss;
+  nr_l2_lookup = nr_lookup - tlb->nr_l1_hit;
+  nr_l2_hit = tlb->nr_hit - tlb->nr_l1_hit;
+  printf("tlb_stat %s: L1 %d entries, hit %lu (hit rate %lu%%), "
+         "L2 %d sets x %d ways, hit %lu (hit rate %lu%%), miss %lu, "
+         "avg latency %lu.%02lu cycles\n",
+         name, tlb->l1_nents, tlb->nr_l1_hit,
+         nr_lookup ? tlb->nr_l1_hit * 100 / nr_lookup : 0, tlb->nsets,
+         tlb->nways, nr_l2_hit, nr_l2_lookup ? nr_l2_hit * 100 / nr_l2_lookup : 0,
+         tlb->nr_miss, nr_lookup ? tlb->latency / nr_lookup : 0,
+         nr_lookup ? tlb->latency * 100 / nr_lookup % 100 : 0);
+#ifdef CPUTLB_PREFETCH
+  printf("tlb_stat %s: prefetch issued %lu, useful %lu (accuracy %lu%%, "
+         "coverage %lu%%)\n",
+         name, tlb->nr_pf_issued, tlb->nr_pf_useful,
+         tlb->nr_pf_issued ? tlb->nr_pf_useful * 100 / tlb->nr_pf_issued : 0,
+         (tlb->nr_pf_useful + tlb->nr_miss)
+             ? tlb->nr_pf_useful * 100 / (tlb->nr_pf_useful + tlb->nr_miss)
+             : 0);
+#endif
+  l1_reach = tlb_reach(tlb->l1_tag, tlb->l1_nents, &l1_huge);
+  l2_reach = tlb_reach(tlb->tag, tlb->nsets * tlb->nways, &l2_huge);
+  printf("tlb_stat %s: reach L1 %lu bytes (%d huge entries), L2 %lu bytes "
+         "(%d huge entries)\n",
+         name, l1_reach, l1_huge, l2_reach, l2_huge);
+  printf("tlb_stat %s: flush %lu, shootdown %lu/%lu requests (%lu entries), "
+         "ASID rollover %lu\n",
+         name, tlb->nr_flush, tlb->nr_shootdown, shootdown_req, tlb->nr_inval,
+         asid_rollover);
+  return 0;
+}
+
+/*
+ *  Init TLB struct
+ *  @tlb: TLB
+ *  @max_size: L2 storage in bytes, TLB_ENTRY_SZ bytes per entry
+ *  @l1_entries: L1 entries, 0 for a single level TLB
+ *  @ways: L2 associativity
+ */
+int init_tlb(struct tlb_struct *tlb, int max_size, int l1_entries, int ways) {
+  int nentries = max_size / TLB_ENTRY_SZ;
+
+  tlb->l1_nents = (l1_entries > 0) ? l1_entries : 0;
+  tlb->l1_tag = calloc(tlb->l1_nents + 1, sizeof(uint64_t));
+  tlb->l1_pfn = calloc(tlb->l1_nents + 1, sizeof(int));
+  tlb->l1_lru = calloc(tlb->l1_nents + 1, sizeof(unsigned long));
+
+  tlb->nways = (ways > 0) ? ways : CPUTLB_WAYS;
+  tlb->nsets = nentries / tlb->nways;
+  if (tlb->nsets < 1)
+    tlb->nsets = 1;
+
+  nentries = tlb->nsets * tlb->nways;
+  tlb->tag = calloc(nentries, sizeof(uint64_t));
+  tlb->pfn = calloc(nentries, sizeof(int));
+  tlb->lru = calloc(nentries, sizeof(unsigned long));
+  tlb->clock = 0;
+  tlb->asid_gen = 1; /* first generation handed out */
+  tlb->nr_hit = 0;
+  tlb->nr_l1_hit = 0;
+  tlb->nr_miss = 0;
+  tlb->latency = 0;
+  tlb->nr_pf_issued = 0;
+  tlb->nr_pf_useful = 0;
+  tlb->nr_flush = 0;
+  tlb->nr_shootdown = 0;
+  tlb->nr_inval = 0;
+
+  tlb->inval = calloc(CPUTLB_INVAL_SLOTS, sizeof(struct tlb_inval_struct));
+  tlb->inval_head = 0;
+  tlb->inval_tail = 0;
+  tlb->inval_all = 0;
+  pthread_mutex_init(&tlb->inval_lock, NULL);
+  tlb->active = 0;
+
+  pthread_mutex_lock(&tlb_list_lock);
+  tlb->id = tlb_nr++;
+  tlb->next = tlb_list;
+  __atomic_store_n(&tlb_list, tlb, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&tlb_list_lock);
   return 0;
 }
 
-//#endif
\ No newline at end of file
+#endif
+//#endif
@@ -38,6 +38,13 @@ struct pcb_t * load(const char * path) {
 		(struct page_table_t*)malloc(sizeof(struct page_table_t));
 	proc->bp = PAGE_SIZE;
 	proc->pc = 0;
+#ifdef CPU_CYCLE_MODEL
+	proc->cycles = 0;
+#endif
+#ifdef CPUTLB_PREFETCH
+	proc->tlb_pf_vpn = -1;
+	proc->tlb_pf_stride = 0;
+#endif
 
 	/* Read process code from file */
 	FILE * file;
@@ -47,7 +54,11 @@ struct pcb_t * load(const char * path) {
 	}
 	char opcode[10];
 	proc->code = (struct code_seg_t*)malloc(sizeof(struct code_seg_t));
-	fscanf(file, "%u %u", &proc->priority, &proc->code->size);
+	if (fscanf(file, "%u %u", &proc->priority, &proc->code->size) != 2) {
+		/* Unreadable header, run it as an empty program */
+		proc->priority = 0;
+		proc->code->size = 0;
+	}
 	proc->code->text = (struct inst_t*)malloc(
 		sizeof(struct inst_t) * proc->code->size
 	);
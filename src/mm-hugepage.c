@@ -0,0 +1,374 @@
+// #ifdef MM_HUGEPAGE
+/*
+ * PAGING based Memory Management
+ * Huge pages mm/mm-hugepage.c
+ *
+ * A huge page is an aligned span of PAGING_HPAGE_NR pages backed by an
+ * aligned run of as many frames. Its PTEs stay in the page table, each
+ * flagged PAGING_PTE_HUGE_MASK and mapping its own frame of the run, so
+ * page walks are unchanged; the TLB caches the whole span in one entry.
+ * The pages of a huge page share one dirty bit, stored in every PTE.
+ *
+ * Frame runs come from a pool carved out of MEMRAM at startup. Spans
+ * fully inside a new heap mapping get a run up front, other spans are
+ * promoted once all their pages are online and private. Evicting any
+ * page of a huge page demotes it back to single pages first.
+ */
+
+#include "mm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef MM_HUGEPAGE
+
+/* Bitmap of a run with every frame allocated */
+#define HPAGE_RUN_FULL (~0ULL >> (64 - PAGING_HPAGE_NR))
+
+/*
+ *  init_hpage_pool - reserve the huge page frame runs of MEMRAM
+ *  @mram: MEMRAM, no frame handed out yet but the zero frame
+ *  @percent: share of MEMRAM kept in runs
+ */
+int init_hpage_pool(struct memphy_struct *mram, int percent) {
+  struct hpage_pool_struct *hp;
+  int nr_blocks = (long)mram->maxfp * percent / 100 / PAGING_HPAGE_NR;
+  int base, end, fpn, nr_kept = 0, nr_pooled = 0;
+  int *kept;
+
+  if (mram->maxfp <= 0 || nr_blocks <= 0)
+    return -1;
+
+  /* The highest aligned runs, frames past the last one stay outside */
+  base = (mram->maxfp / PAGING_HPAGE_NR - nr_blocks) * PAGING_HPAGE_NR;
+  end = base + nr_blocks * PAGING_HPAGE_NR;
+
+  hp = malloc(sizeof(struct hpage_pool_struct));
+  hp->base_fpn = base;
+  hp->nr_blocks = nr_blocks;
+  hp->used = malloc(nr_blocks * sizeof(uint64_t));
+  for (fpn = 0; fpn < nr_blocks; fpn++)
+    hp->used[fpn] = HPAGE_RUN_FULL;
+  hp->nr_free = 0;
+  pthread_mutex_init(&hp->lock, NULL);
+  hp->nr_alloc = 0;
+  hp->nr_fail = 0;
+  hp->nr_split = 0;
+
+  /* Drain the free pool, frames of the runs stay there */
+  kept = malloc(mram->maxfp * sizeof(int));
+  while (MEMPHY_get_freefp(mram, &fpn) == 0) {
+    if (fpn < base || fpn >= end) {
+      kept[nr_kept++] = fpn;
+      continue;
+    }
+    hp->used[(fpn - base) / PAGING_HPAGE_NR] &=
+        ~BIT_ULL((fpn - base) % PAGING_HPAGE_NR);
+    nr_pooled++;
+  }
+  for (fpn = 0; fpn < nr_blocks; fpn++)
+    if (hp->used[fpn] == 0)
+      hp->nr_free++;
+
+  /* Put the others back, lowest frame on top as before */
+  while (nr_kept > 0)
+    MEMPHY_put_freefp(mram, kept[--nr_kept]);
+  free(kept);
+
+  /* Free frames of the runs still count as free MEMRAM */
+  __atomic_add_fetch(&mram->free_fp_cnt, nr_pooled, __ATOMIC_RELAXED);
+  mram->hpool = hp;
+
+  return 0;
+}
+
+/*
+ *  hpage_alloc - take a free frame run
+ *  @mram: MEMRAM
+ *  @fpn: return the first frame of the run
+ */
+int hpage_alloc(struct memphy_struct *mram, int *fpn) {
+  struct hpage_pool_struct *hp = mram->hpool;
+  int blk;
+
+  if (hp == NULL)
+    return -1;
+
+  pthread_mutex_lock(&hp->lock);
+  for (blk = 0; blk < hp->nr_blocks; blk++)
+    if (hp->used[blk] == 0)
+      break;
+
+  if (blk == hp->nr_blocks) {
+    hp->nr_fail++;
+    pthread_mutex_unlock(&hp->lock);
+    return -1;
+  }
+
+  hp->used[blk] = HPAGE_RUN_FULL;
+  hp->nr_free--;
+  hp->nr_alloc++;
+  pthread_mutex_unlock(&hp->lock);
+
+  __atomic_sub_fetch(&mram->free_fp_cnt, PAGING_HPAGE_NR, __ATOMIC_RELAXED);
+  *fpn = hp->base_fpn + blk * PAGING_HPAGE_NR;
+
+  return 0;
+}
+
+/*
+ *  hpage_get_frame - take a single frame out of the runs
+ *  @mram: MEMRAM
+ *  @fpn: return frame number
+ *
+ *  Runs already broken up are used first, a free run is only split when
+ *  none of them has a frame left
+ */
+int hpage_get_frame(struct memphy_struct *mram, int *fpn) {
+  struct hpage_pool_struct *hp = mram->hpool;
+  int blk, split = -1;
+
+  pthread_mutex_lock(&hp->lock);
+  for (blk = 0; blk < hp->nr_blocks; blk++) {
+    if (hp->used[blk] != 0 && hp->used[blk] != HPAGE_RUN_FULL)
+      break;
+    if (hp->used[blk] == 0 && split < 0)
+      split = blk;
+  }
+
+  if (blk == hp->nr_blocks) {
+    if (split < 0) {
+      pthread_mutex_unlock(&hp->lock);
+      return -1;
+    }
+    blk = split;
+    hp->nr_free--;
+    hp->nr_split++;
+  }
+
+  *fpn = __builtin_ctzll(~hp->used[blk] & HPAGE_RUN_FULL);
+  hp->used[blk] |= BIT_ULL(*fpn);
+  pthread_mutex_unlock(&hp->lock);
+
+  __atomic_sub_fetch(&mram->free_fp_cnt, 1, __ATOMIC_RELAXED);
+  *fpn += hp->base_fpn + blk * PAGING_HPAGE_NR;
+
+  return 0;
+}
+
+/*
+ *  hpage_put_frame - return a frame to its run
+ *  @mram: MEMRAM
+ *  @fpn: frame number, inside the runs
+ */
+int hpage_put_frame(struct memphy_struct *mram, int fpn) {
+  struct hpage_pool_struct *hp = mram->hpool;
+  int blk = (fpn - hp->base_fpn) / PAGING_HPAGE_NR;
+
+  pthread_mutex_lock(&hp->lock);
+  hp->used[blk] &= ~BIT_ULL((fpn - hp->base_fpn) % PAGING_HPAGE_NR);
+  if (hp->used[blk] == 0)
+    hp->nr_free++;
+  pthread_mutex_unlock(&hp->lock);
+
+  __atomic_add_fetch(&mram->free_fp_cnt, 1, __ATOMIC_RELAXED);
+
+  return 0;
+}
+
+/*
+ *  hpage_map - map a span on a fresh frame run
+ *  @caller: caller, its mm lock is held
+ *  @hpgn: first page of the span, not mapped yet
+ */
+static int hpage_map(struct pcb_t *caller, int hpgn) {
+  struct mm_struct *mm = caller->mm;
+  struct memphy_struct *mram = caller->mram;
+  int fpn, i;
+
+  if (hpage_alloc(mram, &fpn) < 0)
+    return -1;
+
+  /* A new heap page reads as zero, as it does on the zero frame */
+  memset(&mram->storage[PAGING_PHYADDR(fpn, 0)], 0, PAGING_HPAGESZ);
+
+  for (i = 0; i < PAGING_HPAGE_NR; i++) {
+    pte_set_fpn(mm, hpgn + i, fpn + i);
+    SETBIT(*pte_lookup(mm, hpgn + i), PAGING_PTE_HUGE_MASK);
+    MEMPHY_set_rmap(mram, fpn + i, mm, hpgn + i);
+    enlist_pgn_node(&mm->fifo_pgn, hpgn + i);
+  }
+  mm->nr_hpage++;
+  mm->stat.thp_map++;
+
+  return 0;
+}
+
+/*
+ *  vmap_hpage_range - map a range of pages, huge where it can
+ *  @caller: caller, its mm lock is held
+ *  @addr: start address which is aligned to pagesz
+ *  @pgnum: num of mapping pages
+ *  @ret_rg: return mapped region
+ *
+ *  Spans wholly inside the range get a frame run, the pages around them
+ *  are mapped one by one by vm_map_pages
+ */
+int vmap_hpage_range(struct pcb_t *caller, int addr, int pgnum,
+                     struct vm_rg_struct *ret_rg) {
+  struct vm_rg_struct rg;
+  int pgn = PAGING_PGN(addr), end = PAGING_PGN(addr) + pgnum;
+  int nr;
+
+  while (pgn < end) {
+    /* Pages up to the next span boundary */
+    nr = PAGING_HPAGE_NR - PAGING_HPAGE_IDX(pgn);
+    if (nr > end - pgn)
+      nr = end - pgn;
+
+    if (nr < PAGING_HPAGE_NR || hpage_map(caller, pgn) < 0) {
+      if (vm_map_pages(caller, pgn * PAGING_PAGESZ, nr, &rg) < 0)
+        return -1;
+    }
+    pgn += nr;
+  }
+
+  /* The spans at both ends may now be complete with older pages */
+  if (pgnum > 0) {
+    hpage_promote(caller->mm, PAGING_PGN(addr), caller);
+    hpage_promote(caller->mm, end - 1, caller);
+  }
+
+  ret_rg->rg_start = addr;
+  ret_rg->rg_end = addr + pgnum * PAGING_PAGESZ;
+
+  return 0;
+}
+
+/*
+ *  hpage_promote - collapse the span of a page into a huge page
+ *  @mm: owner of the page, locked by the caller
+ *  @pgn: page just brought online or made private
+ *  @caller: caller
+ *
+ *  The span must sit in one vm area with every page online, private and
+ *  accessed. Pages already on an aligned frame run are just flagged,
+ *  others are copied into a fresh run. Return 0 if the span was promoted
+ */
+int hpage_promote(struct mm_struct *mm, int pgn, struct pcb_t *caller) {
+  struct memphy_struct *mram = caller->mram;
+  struct vm_area_struct *vma;
+  int hpgn = PAGING_HPAGE_PGN(pgn);
+  int i, fpn, oldfpn, inplace;
+  pte_t pte, dirty = 0;
+
+  if (mram->hpool == NULL)
+    return -1;
+
+  vma = find_vma(mm, (unsigned long)hpgn * PAGING_PAGESZ);
+  if (vma == NULL ||
+      (unsigned long)(hpgn + PAGING_HPAGE_NR) * PAGING_PAGESZ > vma->vm_end)
+    return -1;
+
+  fpn = PAGING_FPN(pte_get(mm, hpgn));
+  inplace = (PAGING_HPAGE_IDX(fpn) == 0);
+  for (i = 0; i < PAGING_HPAGE_NR; i++) {
+    pte = pte_get(mm, hpgn + i);
+    if (!PAGING_PAGE_ONLINE(pte) ||
+        (pte & (PAGING_PTE_COW_MASK | PAGING_PTE_RAHEAD_MASK |
+                PAGING_PTE_HUGE_MASK)))
+      return -1;
+    if (PAGING_FPN(pte) != fpn + i)
+      inplace = 0;
+    dirty |= PAGING_PAGE_DIRTY(pte);
+  }
+
+  if (!inplace && hpage_alloc(mram, &fpn) < 0)
+    return -1;
+
+#ifdef CPU_TLB
+  /* Page entries give way to the huge entry, they may point to the old
+   * frames */
+  tlb_shootdown(mm, hpgn, hpgn + PAGING_HPAGE_NR);
+#endif
+#ifdef MM_XLATE_CACHE
+  xlate_inval(mm, hpgn, hpgn + PAGING_HPAGE_NR);
+#endif
+  if (!inplace) {
+    /* Contents do not change, retained swap slots stay valid */
+    for (i = 0; i < PAGING_HPAGE_NR; i++) {
+      oldfpn = PAGING_FPN(pte_get(mm, hpgn + i));
+      __swap_cp_page(mram, oldfpn, mram, fpn + i);
+      pte_set_fpn(mm, hpgn + i, fpn + i);
+      MEMPHY_set_rmap(mram, fpn + i, mm, hpgn + i);
+      MEMPHY_put_freefp(mram, oldfpn);
+    }
+  }
+
+  for (i = 0; i < PAGING_HPAGE_NR; i++) {
+    pte_t *ptep = pte_lookup(mm, hpgn + i);
+
+    SETBIT(*ptep, PAGING_PTE_HUGE_MASK);
+    if (dirty)
+      PAGING_PTE_SET_DIRTY(*ptep);
+  }
+  mm->nr_hpage++;
+  mm->stat.thp_promote++;
+
+  return 0;
+}
+
+/*
+ *  hpage_demote - split a huge page back into single pages
+ *  @mm: owner, locked by the caller
+ *  @pgn: any page of the huge page
+ *
+ *  The pages keep their frames, only the huge TLB entry goes away
+ */
+int hpage_demote(struct mm_struct *mm, int pgn) {
+  int hpgn = PAGING_HPAGE_PGN(pgn);
+  int i;
+
+  for (i = 0; i < PAGING_HPAGE_NR; i++)
+    CLRBIT(*pte_lookup(mm, hpgn + i), PAGING_PTE_HUGE_MASK);
+
+#ifdef CPU_TLB
+  tlb_shootdown(mm, hpgn, hpgn + PAGING_HPAGE_NR);
+#endif
+  mm->nr_hpage--;
+  mm->stat.thp_demote++;
+
+  return 0;
+}
+
+/*
+ *  hpage_set_dirty - mark every page of a huge page dirty
+ *  @mm: owner, locked by the caller
+ *  @pgn: page being stored to
+ */
+int hpage_set_dirty(struct mm_struct *mm, int pgn) {
+  int hpgn = PAGING_HPAGE_PGN(pgn);
+  int i;
+
+  for (i = 0; i < PAGING_HPAGE_NR; i++)
+    PAGING_PTE_SET_DIRTY(*pte_lookup(mm, hpgn + i));
+
+  return 0;
+}
+
+int print_hpage_stat(struct memphy_struct *mram) {
+  struct hpage_pool_struct *hp = mram->hpool;
+
+  if (hp == NULL)
+    return -1;
+
+  printf("hugepage_stat: pool %d runs of %d frames, free %d, huge pages "
+         "allocated %lu, failed %lu, runs split %lu\n",
+         hp->nr_blocks, PAGING_HPAGE_NR, hp->nr_free, hp->nr_alloc,
+         hp->nr_fail, hp->nr_split);
+  return 0;
+}
+
+#endif
+
+// #endif
@@ -0,0 +1,291 @@
+// #ifdef MM_KSM
+/*
+ * PAGING based Memory Management
+ * Same page merging mm/mm-ksm.c
+ *
+ * ksmd is a timer attached device walking the MEMRAM frame table a batch
+ * of frames per time slot. All-zero frames are remapped on the shared
+ * zero frame, frames with identical content (across processes) are
+ * merged into one copy-on-write frame and the duplicates are freed.
+ */
+
+#include "mm.h"
+#include "timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef MM_KSM
+
+static int ksmd_stopped = 0;
+static int ksm_hand = 0; /* next frame to scan */
+
+/* Frames seen in the current pass, chained per checksum bucket */
+static int *ksm_head = NULL;
+static int *ksm_next = NULL;
+static uint32_t *ksm_csum = NULL;
+
+static unsigned long ksm_full_scans = 0;
+static unsigned long ksm_merged = 0;
+static unsigned long ksm_zero_merged = 0;
+
+static uint32_t ksm_checksum(BYTE *page) {
+  uint32_t hash = 2166136261u; /* FNV-1a */
+  int i;
+
+  for (i = 0; i < PAGING_PAGESZ; i++)
+    hash = (hash ^ (unsigned char)page[i]) * 16777619u;
+
+  return hash;
+}
+
+static int ksm_zero_filled(BYTE *page) {
+  int i;
+
+  for (i = 0; i < PAGING_PAGESZ; i++)
+    if (page[i] != 0)
+      return 0;
+
+  return 1;
+}
+
+/*ksm_merge - remap the single mapping of a frame onto an identical one
+ *@mram: MEMRAM
+ *@fpn: duplicated frame, released on return
+ *@kfpn: frame kept (may be the zero frame)
+ *
+ * Caller holds the locks of both owners and the stripes of both frames
+ */
+static void ksm_merge(struct memphy_struct *mram, int fpn, int kfpn) {
+  struct framephy_struct *fp = &mram->frmtbl[fpn];
+  struct framephy_struct *kfp = &mram->frmtbl[kfpn];
+  struct mm_struct *mm = fp->owner;
+  int pgn = fp->pgn;
+  pte_t *pte = pte_lookup(mm, pgn);
+  pte_t dirty = PAGING_PAGE_DIRTY(*pte);
+
+  pte_set_fpn(mm, pgn, kfpn);
+  SETBIT(*pte, PAGING_PTE_COW_MASK);
+  if (dirty)
+    PAGING_PTE_SET_DIRTY(*pte);
+
+  if (kfpn == mram->zero_fpn) {
+    /* The zero frame pins nothing, the page is no eviction candidate */
+    delist_pgn_node(&mm->fifo_pgn, pgn);
+  } else {
+    /* The page stays on its fifo, evicting it drops one mapping of the
+     * frame, the last one frees it even once the rmap owner is gone */
+    kfp->mapcount++;
+    if (kfp->owner != NULL)
+      SETBIT(*pte_lookup(kfp->owner, kfp->pgn), PAGING_PTE_COW_MASK);
+  }
+
+  /* Unmapped, the caller returns the frame once the stripes are released */
+  fp->owner = NULL;
+  fp->pgn = -1;
+  fp->mapcount = 0;
+}
+
+/*ksm_try_merge - lock both sides of a candidate merge and apply it
+ *@mram: MEMRAM
+ *@mm: owner of @fpn, already locked by the caller
+ *@fpn: frame to drop
+ *@kfpn: frame to keep
+ *
+ * Return 0 if merged, -1 if the frames differ or the owner of @kfpn is
+ * busy on another CPU
+ */
+static int ksm_try_merge(struct memphy_struct *mram, struct mm_struct *mm,
+                         int fpn, int kfpn) {
+  struct framephy_struct *kfp = &mram->frmtbl[kfpn];
+  struct mm_struct *kmm;
+  int lo = fpn % MEMPHY_FRMLOCK_STRIPES, hi = kfpn % MEMPHY_FRMLOCK_STRIPES;
+  int locked = 0, ret = -1;
+
+  /* Hold the owner of the kept frame so it cannot store meanwhile, taken
+   * under the frame lock so that it cannot exit in between */
+  MEMPHY_lock_frame(mram, kfpn);
+  kmm = kfp->owner;
+  if (kmm != NULL && MM_LOCKP(kmm) != MM_LOCKP(mm)) {
+    if (pthread_mutex_trylock(MM_LOCKP(kmm)) != 0) {
+      MEMPHY_unlock_frame(mram, kfpn);
+      return -1;
+    }
+    locked = 1;
+  }
+  MEMPHY_unlock_frame(mram, kfpn);
+
+  if (lo > hi) {
+    int tmp = lo;
+    lo = hi;
+    hi = tmp;
+  }
+  pthread_mutex_lock(&mram->frmlock[lo]);
+  if (hi != lo)
+    pthread_mutex_lock(&mram->frmlock[hi]);
+
+  /* The kept frame may have become part of a huge page since it was seen */
+  if (mram->frmtbl[fpn].owner == mm && mram->frmtbl[fpn].mapcount == 1 &&
+      kfp->owner == kmm && (kfpn == mram->zero_fpn || kfp->mapcount >= 1) &&
+      (kmm == NULL || !(pte_get(kmm, kfp->pgn) & PAGING_PTE_HUGE_MASK))) {
+#ifdef CPU_TLB
+    /* Drop cached translations of both pages before comparing them, the
+     * merged page is only reachable through a fresh page walk */
+    tlb_shootdown(mm, mram->frmtbl[fpn].pgn, mram->frmtbl[fpn].pgn + 1);
+    if (kmm != NULL)
+      tlb_shootdown(kmm, kfp->pgn, kfp->pgn + 1);
+#endif
+#ifdef MM_XLATE_CACHE
+    /* The kept page turns copy-on-write, its stores must fault */
+    xlate_inval(mm, mram->frmtbl[fpn].pgn, mram->frmtbl[fpn].pgn + 1);
+    if (kmm != NULL)
+      xlate_inval(kmm, kfp->pgn, kfp->pgn + 1);
+#endif
+    if (memcmp(&mram->storage[PAGING_PHYADDR(fpn, 0)],
+               &mram->storage[PAGING_PHYADDR(kfpn, 0)], PAGING_PAGESZ) == 0) {
+      ksm_merge(mram, fpn, kfpn);
+      ret = 0;
+    }
+  }
+
+  if (hi != lo)
+    pthread_mutex_unlock(&mram->frmlock[hi]);
+  pthread_mutex_unlock(&mram->frmlock[lo]);
+  if (locked)
+    pthread_mutex_unlock(MM_LOCKP(kmm));
+
+  if (ret == 0)
+    MEMPHY_put_freefp(mram, fpn);
+  return ret;
+}
+
+/*ksm_scan - scan a batch of MEMRAM frames for merging
+ *@mram: MEMRAM
+ *@nr_pages: number of frames to scan
+ *
+ */
+int ksm_scan(struct memphy_struct *mram, int nr_pages) {
+  int nr_merged = 0;
+  int i, c;
+
+  if (mram == NULL || mram->maxfp <= 0)
+    return -1;
+
+  if (ksm_head == NULL) {
+    ksm_head = malloc(mram->maxfp * sizeof(int));
+    ksm_next = malloc(mram->maxfp * sizeof(int));
+    ksm_csum = malloc(mram->maxfp * sizeof(uint32_t));
+    for (i = 0; i < mram->maxfp; i++)
+      ksm_head[i] = -1;
+  }
+
+  for (i = 0; i < nr_pages; i++) {
+    int fpn = ksm_hand;
+    struct framephy_struct *fp = &mram->frmtbl[fpn];
+    BYTE *page = &mram->storage[PAGING_PHYADDR(fpn, 0)];
+    struct mm_struct *mm;
+    uint32_t csum;
+    int bucket, pgn, merged = 0;
+    pte_t pte;
+
+    ksm_hand = (ksm_hand + 1) % mram->maxfp;
+    if (ksm_hand == 0) {
+      /* Start over a new pass with an empty table */
+      for (c = 0; c < mram->maxfp; c++)
+        ksm_head[c] = -1;
+      ksm_full_scans++;
+    }
+
+    if (fpn == mram->zero_fpn)
+      continue;
+
+    /* Only privately mapped, online frames are candidates; their content
+     * is stable while the owner is locked. Huge pages are left whole. The
+     * owner is trylocked before the frame lock is dropped so that it
+     * cannot exit meanwhile */
+    MEMPHY_lock_frame(mram, fpn);
+    mm = fp->owner;
+    pgn = fp->pgn;
+    if (mm == NULL || pgn < 0 || pthread_mutex_trylock(MM_LOCKP(mm)) != 0) {
+      MEMPHY_unlock_frame(mram, fpn);
+      continue;
+    }
+    MEMPHY_unlock_frame(mram, fpn);
+    pte = pte_get(mm, pgn);
+    if (fp->owner != mm || fp->pgn != pgn || fp->mapcount != 1 ||
+        !PAGING_PAGE_ONLINE(pte) || PAGING_FPN(pte) != fpn ||
+        (pte & PAGING_PTE_HUGE_MASK)) {
+      pthread_mutex_unlock(MM_LOCKP(mm));
+      continue;
+    }
+
+    if (mram->zero_fpn >= 0 && ksm_zero_filled(page)) {
+      if (ksm_try_merge(mram, mm, fpn, mram->zero_fpn) == 0) {
+        ksm_zero_merged++;
+        nr_merged++;
+      }
+      pthread_mutex_unlock(MM_LOCKP(mm));
+      continue;
+    }
+
+    csum = ksm_checksum(page);
+    bucket = csum % mram->maxfp;
+    for (c = ksm_head[bucket]; c >= 0; c = ksm_next[c]) {
+      if (c == fpn || ksm_csum[c] != csum)
+        continue;
+      if (ksm_try_merge(mram, mm, fpn, c) == 0) {
+        merged = 1;
+        break;
+      }
+    }
+    pthread_mutex_unlock(MM_LOCKP(mm));
+
+    if (merged) {
+      ksm_merged++;
+      nr_merged++;
+    } else {
+      ksm_csum[fpn] = csum;
+      ksm_next[fpn] = ksm_head[bucket];
+      ksm_head[bucket] = fpn;
+    }
+  }
+
+  return nr_merged;
+}
+
+void *ksmd_routine(void *args) {
+  struct ksmd_args *ka = (struct ksmd_args *)args;
+
+  while (!__atomic_load_n(&ksmd_stopped, __ATOMIC_ACQUIRE)) {
+    ksm_scan(ka->mram, MM_KSM_BATCH);
+    next_slot(ka->timer_id);
+  }
+
+  detach_event(ka->timer_id);
+  pthread_exit(NULL);
+}
+
+void ksmd_stop(void) {
+  __atomic_store_n(&ksmd_stopped, 1, __ATOMIC_RELEASE);
+}
+
+int print_ksm_stat(struct memphy_struct *mram) {
+  int fpn, nr_shared = 0;
+
+  if (mram == NULL)
+    return -1;
+
+  for (fpn = 0; fpn < mram->maxfp; fpn++)
+    if (mram->frmtbl[fpn].mapcount > 1)
+      nr_shared++;
+
+  printf("ksm_stat: full scans %lu, merged %lu, zero merged %lu, "
+         "shared frames %d, MEMRAM frames in use %d/%d\n",
+         ksm_full_scans, ksm_merged, ksm_zero_merged, nr_shared,
+         mram->maxfp - mram->free_fp_cnt, mram->maxfp);
+  return 0;
+}
+
+#endif
+
+// #endif
@@ -0,0 +1,89 @@
+// #ifdef MM_KSWAPD
+/*
+ * PAGING based Memory Management
+ * Background page reclaim mm/mm-kswapd.c
+ *
+ * kswapd is a timer attached device: every time slot it checks the free
+ * frames of MEMRAM and, once they drop below the low watermark, evicts
+ * pages in batches until the high watermark is met again. Faults then
+ * find a free frame instead of reclaiming on the critical path.
+ */
+
+#include "mm.h"
+#include "timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef MM_KSWAPD
+
+static int kswapd_stopped = 0;
+static int kswapd_hand = 0; /* clock hand over the frame table */
+
+static unsigned long kswapd_wakeup = 0;
+static unsigned long kswapd_reclaimed = 0;
+
+/*kswapd_balance - reclaim MEMRAM frames up to the high watermark
+ *@mram: MEMRAM
+ *@mswp: MEMSWP to write back to
+ *
+ */
+int kswapd_balance(struct memphy_struct *mram, struct memphy_struct *mswp) {
+  int lowmark, highmark;
+  int nr_scan, nr_reclaimed = 0;
+
+  if (mram == NULL || mswp == NULL || mram->maxfp <= 0)
+    return -1;
+
+  lowmark = mram->maxfp * MM_KSWAPD_LOWMARK / 100;
+  highmark = mram->maxfp * MM_KSWAPD_HIGHMARK / 100;
+  if (lowmark < 1)
+    lowmark = 1;
+  if (highmark < lowmark)
+    highmark = lowmark;
+
+  if (__atomic_load_n(&mram->free_fp_cnt, __ATOMIC_RELAXED) >= lowmark)
+    return 0;
+
+  kswapd_wakeup++;
+  for (nr_scan = 0;
+       nr_scan < mram->maxfp && nr_reclaimed < MM_KSWAPD_BATCH &&
+       __atomic_load_n(&mram->free_fp_cnt, __ATOMIC_RELAXED) < highmark;
+       nr_scan++) {
+    int fpn = kswapd_hand;
+
+    kswapd_hand = (kswapd_hand + 1) % mram->maxfp;
+    if (__reclaim_frame(NULL, mram, mswp, fpn) == 0) {
+      MEMPHY_put_freefp(mram, fpn);
+      nr_reclaimed++;
+    }
+  }
+  kswapd_reclaimed += nr_reclaimed;
+
+  return nr_reclaimed;
+}
+
+void *kswapd_routine(void *args) {
+  struct kswapd_args *ka = (struct kswapd_args *)args;
+
+  while (!__atomic_load_n(&kswapd_stopped, __ATOMIC_ACQUIRE)) {
+    kswapd_balance(ka->mram, ka->mswp);
+    next_slot(ka->timer_id);
+  }
+
+  detach_event(ka->timer_id);
+  pthread_exit(NULL);
+}
+
+void kswapd_stop(void) {
+  __atomic_store_n(&kswapd_stopped, 1, __ATOMIC_RELEASE);
+}
+
+int print_kswapd_stat(void) {
+  printf("kswapd_stat: wakeup %lu, reclaimed %lu frames\n", kswapd_wakeup,
+         kswapd_reclaimed);
+  return 0;
+}
+
+#endif
+
+// #endif
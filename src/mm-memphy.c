@@ -13,21 +13,24 @@
  *  MEMPHY_mv_csr - move MEMPHY cursor
  *  @mp: memphy struct
  *  @offset: offset
+ *
+ *  The head jumps straight to @offset, the travel is charged to the
+ *  device latency as one seek plus a cost per byte passed over
  */
+int MEMPHY_mv_csr(struct memphy_struct *mp, paddr_t offset) {
+  paddr_t dist;
 
-pthread_mutex_t wrt_lock;
-pthread_mutex_t mtx;
-int readcnt = 0;
+  if (offset >= mp->maxsz)
+    return -1;
 
-int MEMPHY_mv_csr(struct memphy_struct *mp, int offset) {
-  int numstep = 0;
+  dist = (offset > mp->cursor) ? offset - mp->cursor : mp->cursor - offset;
 
-  mp->cursor = 0;
-  while (numstep < offset && numstep < mp->maxsz) {
-    /* Traverse sequentially */
-    mp->cursor = (mp->cursor + 1) % mp->maxsz;
-    numstep++;
+  if (dist > 0) {
+    mp->nr_seek++;
+    mp->seek_dist += dist;
+    mp->latency += MM_SEQ_SEEK_COST + (unsigned long)dist * MM_SEQ_SEEK_BYTE_COST;
   }
+  mp->cursor = offset;
 
   return 0;
 }
@@ -38,16 +41,26 @@ int MEMPHY_mv_csr(struct memphy_struct *mp, int offset) {
  *  @addr: address
  *  @value: obtained value
  */
-int MEMPHY_seq_read(struct memphy_struct *mp, int addr, BYTE *value) {
+int MEMPHY_seq_read(struct memphy_struct *mp, paddr_t addr, BYTE *value) {
   if (mp == NULL)
     return -1;
 
-  if (!mp->rdmflg)
+  if (mp->rdmflg)
     return -1; /* Not compatible mode for sequential read */
 
-  MEMPHY_mv_csr(mp, addr);
+  pthread_mutex_lock(&mp->csr_lock);
+  if (MEMPHY_mv_csr(mp, addr) < 0) {
+    pthread_mutex_unlock(&mp->csr_lock);
+    return -1;
+  }
   *value = (BYTE)mp->storage[addr];
 
+  /* Head is left past the byte, the next one streams without a seek */
+  mp->cursor = (addr + 1) % mp->maxsz;
+  mp->nr_xfer++;
+  mp->latency += MM_SEQ_XFER_COST;
+  pthread_mutex_unlock(&mp->csr_lock);
+
   return 0;
 }
 
@@ -57,7 +70,7 @@ int MEMPHY_seq_read(struct memphy_struct *mp, int addr, BYTE *value) {
  *  @addr: address
  *  @value: obtained value
  */
-int MEMPHY_read(struct memphy_struct *mp, int addr, BYTE *value) {
+int MEMPHY_read(struct memphy_struct *mp, paddr_t addr, BYTE *value) {
   if (mp == NULL)
     return -1;
 
@@ -75,17 +88,26 @@ int MEMPHY_read(struct memphy_struct *mp, int addr, BYTE *value) {
  *  @addr: address
  *  @data: written data
  */
-int MEMPHY_seq_write(struct memphy_struct *mp, int addr, BYTE value) {
+int MEMPHY_seq_write(struct memphy_struct *mp, paddr_t addr, BYTE value) {
 
   if (mp == NULL)
     return -1;
 
-  if (!mp->rdmflg)
-    return -1; /* Not compatible mode for sequential read */
+  if (mp->rdmflg)
+    return -1; /* Not compatible mode for sequential write */
 
-  MEMPHY_mv_csr(mp, addr);
+  pthread_mutex_lock(&mp->csr_lock);
+  if (MEMPHY_mv_csr(mp, addr) < 0) {
+    pthread_mutex_unlock(&mp->csr_lock);
+    return -1;
+  }
   mp->storage[addr] = value;
 
+  mp->cursor = (addr + 1) % mp->maxsz;
+  mp->nr_xfer++;
+  mp->latency += MM_SEQ_XFER_COST;
+  pthread_mutex_unlock(&mp->csr_lock);
+
   return 0;
 }
 
@@ -95,7 +117,7 @@ int MEMPHY_seq_write(struct memphy_struct *mp, int addr, BYTE value) {
  *  @addr: address
  *  @data: written data
  */
-int MEMPHY_write(struct memphy_struct *mp, int addr, BYTE data) {
+int MEMPHY_write(struct memphy_struct *mp, paddr_t addr, BYTE data) {
   if (mp == NULL)
     return -1;
 
@@ -110,47 +132,95 @@ int MEMPHY_write(struct memphy_struct *mp, int addr, BYTE data) {
 /*
  *  MEMPHY_format-format MEMPHY device
  *  @mp: memphy struct
+ *
+ *  The frame table keeps one descriptor per physical frame, the free
+ *  pool is threaded through it so getting/putting a frame never allocates
  */
 int MEMPHY_format(struct memphy_struct *mp, int pagesz) {
   /* This setting come with fixed constant PAGESZ */
   int numfp = mp->maxsz / pagesz;
-  struct framephy_struct *newfst, *fst;
+  struct framephy_struct *fst;
   int iter = 0;
 
+  mp->frmtbl = NULL;
+  mp->maxfp = 0;
+  mp->free_fp_cnt = 0;
+  mp->free_fp_head = 0;
+  mp->used_fp_list = NULL;
+
+  for (iter = 0; iter < MEMPHY_FRMLOCK_STRIPES; iter++)
+    pthread_mutex_init(&mp->frmlock[iter], NULL);
+
   if (numfp <= 0)
     return -1;
 
-  /* Init head of free framephy list */
-  fst = malloc(sizeof(struct framephy_struct));
-  fst->fpn = iter;
-  mp->free_fp_list = fst;
-
-  /* We have list with first element, fill in the rest num-1 element member*/
-  for (iter = 1; iter < numfp; iter++) {
-    newfst = malloc(sizeof(struct framephy_struct));
-    newfst->fpn = iter;
-    newfst->fp_next = NULL;
-    fst->fp_next = newfst;
-    fst = newfst;
+  mp->frmtbl = malloc(numfp * sizeof(struct framephy_struct));
+  mp->maxfp = numfp;
+
+  /* Init frame table, every frame starts in the free pool */
+  for (iter = 0; iter < numfp; iter++) {
+    fst = &mp->frmtbl[iter];
+    fst->fpn = iter;
+    fst->fp_next = NULL;
+    fst->owner = NULL;
+    fst->pgn = -1;
+    fst->mapcount = 0;
+    fst->free_next = (iter + 1 < numfp) ? iter + 2 : 0;
   }
+  mp->free_fp_head = 1;
+  mp->free_fp_cnt = numfp;
 
   return 0;
 }
 
+/*
+ *  MEMPHY_get_freefp - pop a frame from the free pool
+ *  @mp: memphy struct
+ *  @retfpn: return frame number
+ *
+ *  Treiber stack over the frame table, the tag bumped on every update
+ *  keeps a stale head from being swapped in (ABA)
+ */
 int MEMPHY_get_freefp(struct memphy_struct *mp, int *retfpn) {
-  struct framephy_struct *fp = mp->free_fp_list;
+  uint64_t head, newhead;
+  int top;
+
+  head = __atomic_load_n(&mp->free_fp_head, __ATOMIC_ACQUIRE);
+  do {
+    top = (int)(head & 0xffffffffu);
+    if (top == 0) {
+#ifdef MM_HUGEPAGE
+      /* Last resort before reclaim, a frame of a huge page run */
+      if (mp->hpool != NULL)
+        return hpage_get_frame(mp, retfpn);
+#endif
+      return -1;
+    }
 
-  if (fp == NULL)
-    return -1;
+    newhead = (((head >> 32) + 1) << 32) |
+              (uint32_t)__atomic_load_n(&mp->frmtbl[top - 1].free_next,
+                                        __ATOMIC_RELAXED);
+  } while (!__atomic_compare_exchange_n(&mp->free_fp_head, &head, newhead, 1,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
 
-  *retfpn = fp->fpn;
-  mp->free_fp_list = fp->fp_next;
+  __atomic_sub_fetch(&mp->free_fp_cnt, 1, __ATOMIC_RELAXED);
+  *retfpn = top - 1;
 
-  /* MEMPHY is iteratively used up until its exhausted
-   * No garbage collector acting then it not been released
-   */
-  free(fp);
+  return 0;
+}
+
+/*
+ *  print_memphy_stat - report the access cost of a sequential device
+ *  @mp: memphy struct
+ *  @name: device name
+ */
+int print_memphy_stat(struct memphy_struct *mp, const char *name) {
+  if (mp == NULL || mp->rdmflg)
+    return -1;
 
+  printf("memphy_stat %s: seeks %lu, head travel %lu bytes, transferred %lu "
+         "bytes, latency %lu\n",
+         name, mp->nr_seek, mp->seek_dist, mp->nr_xfer, mp->latency);
   return 0;
 }
 
@@ -163,10 +233,10 @@ int MEMPHY_dump(struct memphy_struct *mp) {
   }
 
   printf("---MEM DUMP---\n");
-  int i;
+  paddr_t i;
   for (i = 0; i < mp->maxsz; i++){
     if (mp->storage[i] != 0){
-      printf("Address=[%u],Value=[%u]\n", i, mp->storage[i]);
+      printf("Address=[%lu],Value=[%u]\n", (unsigned long)i, mp->storage[i]);
     }
   }
 
@@ -174,35 +244,91 @@ int MEMPHY_dump(struct memphy_struct *mp) {
 }
 
 int MEMPHY_put_freefp(struct memphy_struct *mp, int fpn) {
-  struct framephy_struct *fp = mp->free_fp_list;
-  struct framephy_struct *newnode = malloc(sizeof(struct framephy_struct));
+  struct framephy_struct *fp;
+  uint64_t head, newhead;
+
+  if (fpn < 0 || fpn >= mp->maxfp)
+    return -1;
+
+  fp = &mp->frmtbl[fpn];
+  MEMPHY_lock_frame(mp, fpn);
+  fp->owner = NULL;
+  fp->pgn = -1;
+  fp->mapcount = 0;
+  MEMPHY_unlock_frame(mp, fpn);
+
+#ifdef MM_HUGEPAGE
+  if (mp->hpool != NULL && fpn >= mp->hpool->base_fpn &&
+      fpn < mp->hpool->base_fpn + mp->hpool->nr_blocks * PAGING_HPAGE_NR)
+    return hpage_put_frame(mp, fpn);
+#endif
+
+  /* Frame goes back on top of the free pool */
+  head = __atomic_load_n(&mp->free_fp_head, __ATOMIC_ACQUIRE);
+  do {
+    __atomic_store_n(&fp->free_next, (int)(head & 0xffffffffu),
+                     __ATOMIC_RELAXED);
+    newhead = (((head >> 32) + 1) << 32) | (uint32_t)(fpn + 1);
+  } while (!__atomic_compare_exchange_n(&mp->free_fp_head, &head, newhead, 1,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+  __atomic_add_fetch(&mp->free_fp_cnt, 1, __ATOMIC_RELAXED);
+
+  return 0;
+}
+
+/*
+ *  MEMPHY_set_rmap - record the page a newly mapped frame backs
+ *  @mp: memphy struct
+ *  @fpn: frame number
+ *  @owner: mm owning the page
+ *  @pgn: page number in @owner
+ */
+int MEMPHY_set_rmap(struct memphy_struct *mp, int fpn, struct mm_struct *owner,
+                    int pgn) {
+  if (fpn < 0 || fpn >= mp->maxfp)
+    return -1;
 
-  /* Create new node with value fpn */
-  newnode->fpn = fpn;
-  newnode->fp_next = fp;
-  mp->free_fp_list = newnode;
+  MEMPHY_lock_frame(mp, fpn);
+  mp->frmtbl[fpn].owner = owner;
+  mp->frmtbl[fpn].pgn = pgn;
+  mp->frmtbl[fpn].mapcount = 1;
+  MEMPHY_unlock_frame(mp, fpn);
 
   return 0;
 }
 
+void MEMPHY_lock_frame(struct memphy_struct *mp, int fpn) {
+  pthread_mutex_lock(&mp->frmlock[fpn % MEMPHY_FRMLOCK_STRIPES]);
+}
+
+void MEMPHY_unlock_frame(struct memphy_struct *mp, int fpn) {
+  pthread_mutex_unlock(&mp->frmlock[fpn % MEMPHY_FRMLOCK_STRIPES]);
+}
+
 /*
  *  Init MEMPHY struct
  */
-int init_memphy(struct memphy_struct *mp, int max_size, int randomflg) {
-  mp->storage = (BYTE *)malloc(max_size * sizeof(BYTE));
+int init_memphy(struct memphy_struct *mp, paddr_t max_size, int randomflg) {
+  /* Zeroed lazily, a multi-GB device only costs the pages it touches */
+  mp->storage = (BYTE *)calloc(max_size, sizeof(BYTE));
   mp->maxsz = max_size;
 
 
   MEMPHY_format(mp, PAGING_PAGESZ);
 
-  for (int i = 0; i < mp->maxsz; i++){
-    mp->storage[i] = 0;
-  }
-
   mp->rdmflg = (randomflg != 0) ? 1 : 0;
+  mp->zswap = NULL;
+  mp->zero_fpn = -1;
+  mp->hpool = NULL;
 
-  if (!mp->rdmflg) /* Not Ramdom acess device, then it serial device*/
-    mp->cursor = 0;
+  /* Head of a serial device starts at the first byte */
+  mp->cursor = 0;
+  mp->nr_seek = 0;
+  mp->seek_dist = 0;
+  mp->nr_xfer = 0;
+  mp->latency = 0;
+  pthread_mutex_init(&mp->csr_lock, NULL);
 
   return 0;
 }
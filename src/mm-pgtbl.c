@@ -0,0 +1,556 @@
+//#ifdef MM_PAGING
+/*
+ * PAGING based Memory Management
+ * Multi-level page table mm/mm-pgtbl.c
+ *
+ * The page table of an mm is a radix tree indexed by PAGING_PT_BITS of
+ * the page number per level. Directories and leaves are allocated on the
+ * first mapping below them, so the table grows with the mapped pages and
+ * not with the address space. A leaf also holds the retained swap slots
+ * of its pages.
+ *
+ * A small direct mapped page walk cache remembers the leaves of recent
+ * walks, a hit skips every directory level.
+ *
+ * With MM_IPT the system can instead be started with one inverted page
+ * table hashed on (mm, page): the PTE of an online page lives in the IPT,
+ * sized by the MEMRAM frames, and only swapped PTEs stay in the radix
+ * table. A PTE moves between both when its page is swapped in or out.
+ */
+
+#include "mm.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Shift of the index into a directory of the given level, 0 is the root */
+#define PT_DIR_SHIFT(lvl) ((PAGING_PT_LEVELS - 1 - (lvl)) * PAGING_PT_BITS)
+#define PT_INDEX(pgn, shift) (((pgn) >> (shift)) & (PAGING_PT_ENTRIES - 1))
+#define PT_LEAF_INDEX(pgn) ((pgn) & (PAGING_PT_ENTRIES - 1))
+
+/* System wide counters, for print_pt_stat */
+static int pt_nr_mm = 0;
+static long pt_nr_dirs = 0;
+static long pt_nr_leaves = 0;
+static unsigned long pt_nr_walk = 0;  /* radix walks of PTE lookups */
+static unsigned long pt_nr_probe = 0; /* table levels they read */
+/* Tables of the exited mms as they were freed, they never shrink before */
+static int pt_exit_mm = 0;
+static long pt_exit_dirs = 0;
+static long pt_exit_leaves = 0;
+
+#ifdef MM_IPT
+static struct ipt_struct *ipt = NULL; /* NULL unless started in IPT mode */
+
+#define IPT_HASH(mm, pgn)                                                      \
+  ((((uintptr_t)(mm) >> 4) * 31 + (unsigned int)(pgn)) * 2654435761u %         \
+   ipt->nbuckets)
+#define IPT_LOCKP(b) (&ipt->lock[(b) % IPT_LOCK_STRIPES])
+#endif
+
+static void pt_pwc_reset(struct mm_struct *mm) {
+  int i;
+
+  for (i = 0; i < PAGING_PWC_ENTRIES; i++) {
+    mm->pwc[i].tag = -1;
+    mm->pwc[i].leaf = NULL;
+  }
+}
+
+static struct pt_leaf_struct *pt_leaf_alloc(struct mm_struct *mm) {
+  struct pt_leaf_struct *leaf = calloc(1, sizeof(struct pt_leaf_struct));
+  int i;
+
+  for (i = 0; i < PAGING_PT_ENTRIES; i++)
+    leaf->swpslot[i] = -1;
+  mm->pt_nr_leaves++;
+  __atomic_fetch_add(&pt_nr_leaves, 1, __ATOMIC_RELAXED);
+
+  return leaf;
+}
+
+/*
+ *  pt_descend - walk the directories down to the leaf of a page
+ *  @mm: address space, locked by the caller
+ *  @pgn: page number, in range
+ *  @alloc: allocate the missing levels
+ */
+static struct pt_leaf_struct *pt_descend(struct mm_struct *mm, int pgn,
+                                         int alloc) {
+  struct pt_dir_struct *dir = mm->pgd;
+  void **slot;
+  int lvl;
+
+  for (lvl = 0; lvl < PAGING_PT_LEVELS - 1; lvl++) {
+    slot = &dir->slot[PT_INDEX(pgn, PT_DIR_SHIFT(lvl))];
+    if (*slot == NULL) {
+      if (!alloc)
+        return NULL;
+
+      /* The last directory level points to leaves */
+      if (lvl == PAGING_PT_LEVELS - 2) {
+        __atomic_store_n(slot, pt_leaf_alloc(mm), __ATOMIC_RELEASE);
+      } else {
+        __atomic_store_n(slot, calloc(1, sizeof(struct pt_dir_struct)),
+                         __ATOMIC_RELEASE);
+        mm->pt_nr_dirs++;
+        __atomic_fetch_add(&pt_nr_dirs, 1, __ATOMIC_RELAXED);
+      }
+    }
+    dir = *slot;
+  }
+
+  return (struct pt_leaf_struct *)dir;
+}
+
+/*
+ *  pt_leaf - find the leaf holding the PTE of a page
+ *  @mm: address space, locked by the caller
+ *  @pgn: page number
+ *  @alloc: allocate the missing levels
+ *
+ *  Return the leaf, NULL if it is not populated and @alloc is 0
+ */
+static struct pt_leaf_struct *pt_leaf(struct mm_struct *mm, int pgn,
+                                      int alloc) {
+  struct pwc_entry_struct *pwc;
+  struct pt_leaf_struct *leaf;
+
+  if (pgn < 0 || pgn >= PAGING_MAX_PGN)
+    return NULL;
+
+  pwc = &mm->pwc[(pgn >> PAGING_PT_BITS) % PAGING_PWC_ENTRIES];
+  if (pwc->tag == (pgn >> PAGING_PT_BITS)) {
+    mm->stat.pwc_hit++;
+    return pwc->leaf;
+  }
+  mm->stat.pwc_miss++;
+
+  leaf = pt_descend(mm, pgn, alloc);
+  if (leaf != NULL) {
+    pwc->tag = pgn >> PAGING_PT_BITS;
+    pwc->leaf = leaf;
+  }
+  return leaf;
+}
+
+#ifdef MM_IPT
+/*
+ *  ipt_find - find the IPT entry of an online page
+ *  @mm: address space, locked by the caller
+ *  @pgn: page number
+ *  @probe: add the chain entries read to, NULL to leave uncounted
+ *
+ *  The entry stays valid while the mm lock is held, only its own mm
+ *  removes it
+ */
+static struct ipt_entry_struct *ipt_find(struct mm_struct *mm, int pgn,
+                                         unsigned long *probe) {
+  unsigned int b = IPT_HASH(mm, pgn);
+  struct ipt_entry_struct *e;
+  unsigned long nr_probe = 1; /* the bucket head */
+
+  pthread_mutex_lock(IPT_LOCKP(b));
+  for (e = ipt->bucket[b]; e != NULL; e = e->next, nr_probe++)
+    if (e->mm == mm && e->pgn == pgn)
+      break;
+  pthread_mutex_unlock(IPT_LOCKP(b));
+
+  if (probe != NULL)
+    *probe += nr_probe;
+  return e;
+}
+
+static struct ipt_entry_struct *ipt_insert(struct mm_struct *mm, int pgn,
+                                           pte_t pte, int swpslot) {
+  unsigned int b = IPT_HASH(mm, pgn);
+  struct ipt_entry_struct *e;
+
+  pthread_mutex_lock(&ipt->free_lock);
+  e = ipt->free_list;
+  if (e != NULL) {
+    ipt->free_list = e->next;
+  } else {
+    /* More mappings than frames, shared frames are mapped several times */
+    e = malloc(sizeof(struct ipt_entry_struct));
+    ipt->nr_entries++;
+  }
+  if (++ipt->nr_used > ipt->nr_peak)
+    ipt->nr_peak = ipt->nr_used;
+  pthread_mutex_unlock(&ipt->free_lock);
+
+  e->mm = mm;
+  e->pgn = pgn;
+  e->pte = pte;
+  e->swpslot = swpslot;
+
+  e->mm_prev = NULL;
+  e->mm_next = mm->ipt_list;
+  if (e->mm_next != NULL)
+    e->mm_next->mm_prev = e;
+  mm->ipt_list = e;
+
+  pthread_mutex_lock(IPT_LOCKP(b));
+  e->next = ipt->bucket[b];
+  ipt->bucket[b] = e;
+  pthread_mutex_unlock(IPT_LOCKP(b));
+
+  return e;
+}
+
+static void ipt_remove(struct ipt_entry_struct *e) {
+  unsigned int b = IPT_HASH(e->mm, e->pgn);
+  struct ipt_entry_struct **pp;
+
+  pthread_mutex_lock(IPT_LOCKP(b));
+  for (pp = &ipt->bucket[b]; *pp != NULL; pp = &(*pp)->next) {
+    if (*pp == e) {
+      *pp = e->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(IPT_LOCKP(b));
+
+  if (e->mm_prev != NULL)
+    e->mm_prev->mm_next = e->mm_next;
+  else
+    e->mm->ipt_list = e->mm_next;
+  if (e->mm_next != NULL)
+    e->mm_next->mm_prev = e->mm_prev;
+
+  pthread_mutex_lock(&ipt->free_lock);
+  e->next = ipt->free_list;
+  ipt->free_list = e;
+  ipt->nr_used--;
+  pthread_mutex_unlock(&ipt->free_lock);
+}
+
+/*
+ *  init_ipt - switch the system to the inverted page table
+ *  @mram: MEMRAM, one bucket and one entry per frame
+ *
+ *  Must run before the first mm is set up
+ */
+int init_ipt(struct memphy_struct *mram) {
+  int i;
+
+  if (mram == NULL || mram->maxfp <= 0)
+    return -1;
+
+  ipt = malloc(sizeof(struct ipt_struct));
+  ipt->nbuckets = mram->maxfp;
+  ipt->bucket = calloc(ipt->nbuckets, sizeof(struct ipt_entry_struct *));
+  for (i = 0; i < IPT_LOCK_STRIPES; i++)
+    pthread_mutex_init(&ipt->lock[i], NULL);
+
+  ipt->free_list = NULL;
+  for (i = 0; i < ipt->nbuckets; i++) {
+    struct ipt_entry_struct *e = malloc(sizeof(struct ipt_entry_struct));
+
+    e->next = ipt->free_list;
+    ipt->free_list = e;
+  }
+  pthread_mutex_init(&ipt->free_lock, NULL);
+  ipt->nr_entries = ipt->nbuckets;
+  ipt->nr_used = 0;
+  ipt->nr_peak = 0;
+  ipt->nr_lookup = 0;
+  ipt->nr_probe = 0;
+
+  return 0;
+}
+#endif
+
+/*
+ *  pte_lookup - get the PTE of a page
+ *  @mm: address space, locked by the caller
+ *  @pgn: page number
+ *
+ *  Return NULL if no page around @pgn was ever mapped
+ */
+pte_t *pte_lookup(struct mm_struct *mm, int pgn) {
+  struct pt_leaf_struct *leaf;
+  unsigned long pwc_miss = mm->stat.pwc_miss;
+
+#ifdef MM_IPT
+  if (ipt != NULL) {
+    unsigned long nr_probe = 0;
+    struct ipt_entry_struct *e = ipt_find(mm, pgn, &nr_probe);
+
+    __atomic_fetch_add(&ipt->nr_lookup, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&ipt->nr_probe, nr_probe, __ATOMIC_RELAXED);
+    if (e != NULL)
+      return &e->pte;
+  }
+#endif
+
+  /* A walk cache hit reads the leaf only */
+  leaf = pt_leaf(mm, pgn, 0);
+  __atomic_fetch_add(&pt_nr_walk, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&pt_nr_probe,
+                     (mm->stat.pwc_miss != pwc_miss) ? PAGING_PT_LEVELS : 1,
+                     __ATOMIC_RELAXED);
+
+  return (leaf == NULL) ? NULL : &leaf->pte[PT_LEAF_INDEX(pgn)];
+}
+
+/*
+ *  pte_alloc - get the PTE a page is mapped through, populating the table
+ *  @mm: address space, locked by the caller
+ *  @pgn: page number
+ *  @online: the page is going to be mapped on a MEMRAM frame
+ *
+ *  In IPT mode the PTE of an online page is in the IPT and the one of a
+ *  swapped page in the radix table, the PTE bits and retained swap slot
+ *  move along when @online changes. PTE pointers got before are stale.
+ */
+pte_t *pte_alloc(struct mm_struct *mm, int pgn, int online) {
+  struct pt_leaf_struct *leaf;
+
+  if (pgn < 0 || pgn >= PAGING_MAX_PGN)
+    return NULL;
+
+#ifdef MM_IPT
+  if (ipt != NULL) {
+    struct ipt_entry_struct *e = ipt_find(mm, pgn, NULL);
+    int idx = PT_LEAF_INDEX(pgn);
+
+    if (online) {
+      if (e != NULL)
+        return &e->pte;
+
+      leaf = pt_leaf(mm, pgn, 0);
+      if (leaf == NULL)
+        return &ipt_insert(mm, pgn, 0, -1)->pte;
+
+      e = ipt_insert(mm, pgn, leaf->pte[idx], leaf->swpslot[idx]);
+      leaf->pte[idx] = 0;
+      leaf->swpslot[idx] = -1;
+      return &e->pte;
+    }
+
+    if (e != NULL) {
+      leaf = pt_leaf(mm, pgn, 1);
+      leaf->pte[idx] = e->pte;
+      leaf->swpslot[idx] = e->swpslot;
+      ipt_remove(e);
+      return &leaf->pte[idx];
+    }
+  }
+#endif
+
+  leaf = pt_leaf(mm, pgn, 1);
+  return &leaf->pte[PT_LEAF_INDEX(pgn)];
+}
+
+/*
+ *  pte_get - read the PTE of a page
+ *  @mm: address space, locked by the caller
+ *  @pgn: page number
+ *
+ *  Return 0 (not present) for an unpopulated page
+ */
+pte_t pte_get(struct mm_struct *mm, int pgn) {
+  pte_t *pte = pte_lookup(mm, pgn);
+
+  return (pte == NULL) ? 0 : *pte;
+}
+
+/*
+ *  pte_swpslot - get the retained swap slot of a page
+ *  @mm: address space, locked by the caller
+ *  @pgn: page number
+ *
+ *  Return NULL for an unpopulated page
+ */
+int *pte_swpslot(struct mm_struct *mm, int pgn) {
+  struct pt_leaf_struct *leaf;
+
+#ifdef MM_IPT
+  if (ipt != NULL) {
+    struct ipt_entry_struct *e = ipt_find(mm, pgn, NULL);
+
+    if (e != NULL)
+      return &e->swpslot;
+  }
+#endif
+
+  leaf = pt_leaf(mm, pgn, 0);
+  return (leaf == NULL) ? NULL : &leaf->swpslot[PT_LEAF_INDEX(pgn)];
+}
+
+static int pt_walk_dir(struct mm_struct *mm, struct pt_dir_struct *dir,
+                       int lvl, int base, int pgn_start, int pgn_end,
+                       pt_walk_fn fn, void *arg) {
+  int span = 1 << PT_DIR_SHIFT(lvl); /* pages below one slot */
+  int i, ret;
+
+  for (i = 0; i < PAGING_PT_ENTRIES; i++) {
+    void *next = __atomic_load_n(&dir->slot[i], __ATOMIC_ACQUIRE);
+    int start = base + (i << PT_DIR_SHIFT(lvl));
+
+    if (next == NULL || start >= pgn_end || start + span <= pgn_start)
+      continue;
+
+    if (lvl == PAGING_PT_LEVELS - 2) {
+      struct pt_leaf_struct *leaf = next;
+      int j;
+
+      for (j = 0; j < PAGING_PT_ENTRIES; j++) {
+        if (start + j < pgn_start || start + j >= pgn_end ||
+            leaf->pte[j] == 0)
+          continue;
+        ret = fn(mm, start + j, &leaf->pte[j], arg);
+        if (ret != 0)
+          return ret;
+      }
+    } else {
+      ret = pt_walk_dir(mm, next, lvl + 1, start, pgn_start, pgn_end, fn,
+                        arg);
+      if (ret != 0)
+        return ret;
+    }
+  }
+
+  return 0;
+}
+
+/*
+ *  pt_walk - visit the PTEs in use in a page range
+ *  @mm: address space
+ *  @pgn_start: first page
+ *  @pgn_end: page past the range
+ *  @fn: called for each non zero PTE, a non zero return stops the walk
+ *  @arg: passed to @fn
+ *
+ *  Only populated directories and leaves are visited, the walk does not
+ *  touch the page walk cache. In IPT mode the online pages of the mm are
+ *  visited from its IPT entry list first, out of page order, then the
+ *  swapped ones from the leaves.
+ */
+int pt_walk(struct mm_struct *mm, int pgn_start, int pgn_end, pt_walk_fn fn,
+            void *arg) {
+  if (mm == NULL || mm->pgd == NULL)
+    return -1;
+
+#ifdef MM_IPT
+  if (ipt != NULL) {
+    struct ipt_entry_struct *e;
+    int ret;
+
+    for (e = mm->ipt_list; e != NULL; e = e->mm_next) {
+      if (e->pgn < pgn_start || e->pgn >= pgn_end || e->pte == 0)
+        continue;
+      ret = fn(mm, e->pgn, &e->pte, arg);
+      if (ret != 0)
+        return ret;
+    }
+  }
+#endif
+
+  return pt_walk_dir(mm, mm->pgd, 0, 0, pgn_start, pgn_end, fn, arg);
+}
+
+static void pt_free_dir(struct pt_dir_struct *dir, int lvl) {
+  int i;
+
+  for (i = 0; i < PAGING_PT_ENTRIES; i++) {
+    if (dir->slot[i] == NULL)
+      continue;
+    if (lvl == PAGING_PT_LEVELS - 2)
+      free(dir->slot[i]);
+    else
+      pt_free_dir(dir->slot[i], lvl + 1);
+  }
+  free(dir);
+}
+
+/*
+ *  pt_free - release the whole page table
+ *  @mm: address space
+ */
+void pt_free(struct mm_struct *mm) {
+#ifdef MM_IPT
+  while (ipt != NULL && mm->ipt_list != NULL)
+    ipt_remove(mm->ipt_list);
+#endif
+
+  if (mm->pgd != NULL) {
+    pt_free_dir(mm->pgd, 0);
+    __atomic_fetch_sub(&pt_nr_mm, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&pt_exit_mm, 1, __ATOMIC_RELAXED);
+  }
+  __atomic_fetch_add(&pt_exit_dirs, mm->pt_nr_dirs, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&pt_exit_leaves, mm->pt_nr_leaves, __ATOMIC_RELAXED);
+  __atomic_fetch_sub(&pt_nr_dirs, mm->pt_nr_dirs, __ATOMIC_RELAXED);
+  __atomic_fetch_sub(&pt_nr_leaves, mm->pt_nr_leaves, __ATOMIC_RELAXED);
+  mm->pgd = NULL;
+  mm->pt_nr_dirs = 0;
+  mm->pt_nr_leaves = 0;
+  pt_pwc_reset(mm);
+}
+
+/*
+ *  pt_init - set up an empty page table
+ *  @mm: address space
+ */
+int pt_init(struct mm_struct *mm) {
+  mm->pgd = calloc(1, sizeof(struct pt_dir_struct));
+  mm->ipt_list = NULL;
+  mm->pt_nr_dirs = 1;
+  __atomic_fetch_add(&pt_nr_mm, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&pt_nr_dirs, 1, __ATOMIC_RELAXED);
+  mm->pt_nr_leaves = 0;
+  pt_pwc_reset(mm);
+  mm->stat.pwc_hit = 0;
+  mm->stat.pwc_miss = 0;
+
+  return 0;
+}
+
+/*
+ *  pt_mem_size - memory held by a page table
+ *  @mm: address space
+ */
+unsigned long pt_mem_size(struct mm_struct *mm) {
+  return mm->pt_nr_dirs * sizeof(struct pt_dir_struct) +
+         mm->pt_nr_leaves * sizeof(struct pt_leaf_struct);
+}
+
+/*
+ *  print_pt_stat - report the translation memory of every mm
+ *
+ *  Live tables are counted with the exited ones as they were freed, the
+ *  IPT reports its peak use
+ */
+int print_pt_stat(void) {
+  int nr_mm = pt_nr_mm + pt_exit_mm;
+  long nr_dirs = pt_nr_dirs + pt_exit_dirs;
+  long nr_leaves = pt_nr_leaves + pt_exit_leaves;
+  unsigned long radix_sz = nr_dirs * sizeof(struct pt_dir_struct) +
+                           nr_leaves * sizeof(struct pt_leaf_struct);
+  unsigned long ipt_sz = 0;
+
+  printf("pt_stat: radix tables of %d mm (%d exited) %lu bytes (%ld dirs, "
+         "%ld leaves), %lu walks reading %.2f levels each\n",
+         nr_mm, pt_exit_mm, radix_sz, nr_dirs, nr_leaves, pt_nr_walk,
+         pt_nr_walk ? (double)pt_nr_probe / pt_nr_walk : 0.0);
+#ifdef MM_IPT
+  if (ipt != NULL) {
+    ipt_sz = ipt->nbuckets * sizeof(struct ipt_entry_struct *) +
+             ipt->nr_entries * sizeof(struct ipt_entry_struct);
+    printf("pt_stat: ipt %d buckets, %d/%d entries used at peak, %lu bytes, "
+           "%lu lookups reading %.2f entries each\n",
+           ipt->nbuckets, ipt->nr_peak, ipt->nr_entries, ipt_sz,
+           ipt->nr_lookup,
+           ipt->nr_lookup ? (double)ipt->nr_probe / ipt->nr_lookup : 0.0);
+  }
+#endif
+  printf("pt_stat: MM translation memory %lu bytes, flat tables would take "
+         "%lu bytes\n",
+         radix_sz + ipt_sz,
+         nr_mm * PAGING_MAX_PGN * (sizeof(pte_t) + sizeof(int)));
+  return 0;
+}
+
+//#endif
@@ -0,0 +1,203 @@
+//#ifdef MM_PAGING
+/*
+ * PAGING based Memory Management
+ * Symbol region table mm/mm-symtbl.c
+ *
+ * Region IDs index a dense vector, doubled whenever a new ID falls within
+ * twice its size, so programs numbering their regions from 0 on get a
+ * plain array lookup. An ID further out is sparse and goes to a hash
+ * table chained per bucket; its entry moves to the vector once the vector
+ * grows over it. Both lookups are O(1), the hash doubles with its entries.
+ */
+
+#include "mm.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SYMRG_HASH_MIN_SHIFT 4 /* 16 buckets for the first sparse ID */
+
+static unsigned int symrg_hash(struct mm_struct *mm, int rgid) {
+  return (uint32_t)((uint32_t)rgid * 2654435761u) >>
+         (32 - mm->symrg_hash_shift);
+}
+
+static struct vm_symrg_struct *symrg_hash_find(struct mm_struct *mm,
+                                               int rgid) {
+  struct vm_symrg_struct *ent;
+
+  if (mm->symrg_hash_shift == 0)
+    return NULL;
+
+  for (ent = mm->symrg_hash[symrg_hash(mm, rgid)]; ent != NULL;
+       ent = ent->next)
+    if (ent->rgid == rgid)
+      return ent;
+
+  return NULL;
+}
+
+/*
+ *  symrg_hash_grow - rehash the sparse entries into twice the buckets
+ *  @mm: memory management struct
+ */
+static void symrg_hash_grow(struct mm_struct *mm) {
+  struct vm_symrg_struct **old = mm->symrg_hash;
+  int oldsz = (old != NULL) ? 1 << mm->symrg_hash_shift : 0;
+  int i;
+
+  mm->symrg_hash_shift = (old != NULL) ? mm->symrg_hash_shift + 1
+                                           : SYMRG_HASH_MIN_SHIFT;
+  mm->symrg_hash =
+      calloc(1 << mm->symrg_hash_shift, sizeof(struct vm_symrg_struct *));
+
+  for (i = 0; i < oldsz; i++) {
+    while (old[i] != NULL) {
+      struct vm_symrg_struct *ent = old[i];
+      unsigned int h = symrg_hash(mm, ent->rgid);
+
+      old[i] = ent->next;
+      ent->next = mm->symrg_hash[h];
+      mm->symrg_hash[h] = ent;
+    }
+  }
+  free(old);
+}
+
+/*
+ *  symrg_vec_grow - double the dense vector until it covers a region ID
+ *  @mm: memory management struct
+ *  @rgid: region ID
+ *
+ *  Sparse entries the vector now covers are moved into it
+ */
+static void symrg_vec_grow(struct mm_struct *mm, int rgid) {
+  int cap = mm->symrg_cap;
+  int i;
+
+  while (cap <= rgid)
+    cap *= 2;
+
+  mm->symrgtbl = realloc(mm->symrgtbl, cap * sizeof(struct vm_rg_struct));
+  memset(&mm->symrgtbl[mm->symrg_cap], 0,
+         (cap - mm->symrg_cap) * sizeof(struct vm_rg_struct));
+  mm->symrg_cap = cap;
+
+  for (i = 0; mm->symrg_nr_hash > 0 && i < (1 << mm->symrg_hash_shift); i++) {
+    struct vm_symrg_struct **pp = &mm->symrg_hash[i];
+
+    while (*pp != NULL) {
+      struct vm_symrg_struct *ent = *pp;
+
+      if (ent->rgid >= cap) {
+        pp = &ent->next;
+        continue;
+      }
+      mm->symrgtbl[ent->rgid] = ent->rg;
+      *pp = ent->next;
+      free(ent);
+      mm->symrg_nr_hash--;
+    }
+  }
+}
+
+/*get_symrg_byid - get mem region by region ID
+ *@mm: memory region
+ *@rgid: region ID act as symbol index of variable
+ *
+ * Return NULL if the ID has no entry, see set_symrg_byid
+ */
+struct vm_rg_struct *get_symrg_byid(struct mm_struct *mm, int rgid) {
+  struct vm_symrg_struct *ent;
+
+  if (rgid < 0)
+    return NULL;
+
+  if (rgid < mm->symrg_cap)
+    return &mm->symrgtbl[rgid];
+
+  ent = symrg_hash_find(mm, rgid);
+  return (ent != NULL) ? &ent->rg : NULL;
+}
+
+/*set_symrg_byid - get mem region by region ID, adding its entry if needed
+ *@mm: memory region
+ *@rgid: region ID act as symbol index of variable
+ *
+ * The entry may move when the table grows, do not keep it across calls
+ */
+struct vm_rg_struct *set_symrg_byid(struct mm_struct *mm, int rgid) {
+  struct vm_symrg_struct *ent;
+  unsigned int h;
+
+  if (rgid < 0)
+    return NULL;
+
+  if (rgid < mm->symrg_cap)
+    return &mm->symrgtbl[rgid];
+
+  /* Close enough to the dense IDs to be worth doubling the vector */
+  if (rgid / 2 < mm->symrg_cap) {
+    symrg_vec_grow(mm, rgid);
+    return &mm->symrgtbl[rgid];
+  }
+
+  ent = symrg_hash_find(mm, rgid);
+  if (ent != NULL)
+    return &ent->rg;
+
+  if (mm->symrg_hash_shift == 0 ||
+      mm->symrg_nr_hash >= (1 << mm->symrg_hash_shift))
+    symrg_hash_grow(mm);
+
+  ent = calloc(1, sizeof(struct vm_symrg_struct));
+  ent->rgid = rgid;
+  h = symrg_hash(mm, rgid);
+  ent->next = mm->symrg_hash[h];
+  mm->symrg_hash[h] = ent;
+  mm->symrg_nr_hash++;
+
+  return &ent->rg;
+}
+
+/*
+ *  init_symtbl - set up the symbol table of an mm
+ *  @mm: memory management struct
+ */
+int init_symtbl(struct mm_struct *mm) {
+  mm->symrg_cap = PAGING_SYMTBL_INIT_SZ;
+  mm->symrgtbl = calloc(mm->symrg_cap, sizeof(struct vm_rg_struct));
+  mm->symrg_hash = NULL;
+  mm->symrg_hash_shift = 0;
+  mm->symrg_nr_hash = 0;
+
+  return 0;
+}
+
+/*
+ *  free_symtbl - release the symbol table of an mm
+ *  @mm: memory management struct
+ */
+void free_symtbl(struct mm_struct *mm) {
+  int i;
+
+  for (i = 0; mm->symrg_hash != NULL && i < (1 << mm->symrg_hash_shift);
+       i++) {
+    while (mm->symrg_hash[i] != NULL) {
+      struct vm_symrg_struct *ent = mm->symrg_hash[i];
+
+      mm->symrg_hash[i] = ent->next;
+      free(ent);
+    }
+  }
+  free(mm->symrg_hash);
+  free(mm->symrgtbl);
+  mm->symrg_hash = NULL;
+  mm->symrgtbl = NULL;
+  mm->symrg_hash_shift = 0;
+  mm->symrg_nr_hash = 0;
+  mm->symrg_cap = 0;
+}
+
+//#endif
@@ -8,62 +8,98 @@
 #include "string.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
-/*enlist_vm_freerg_list - add new rg to freerg_list
+pthread_mutex_t mmvm_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*get_vma_by_num - get vm area by numID
  *@mm: memory region
- *@rg_elmt: new region
+ *@vmaid: ID vm area to alloc memory region
  *
  */
-int enlist_vm_freerg_list(struct mm_struct *mm, struct vm_rg_struct *rg_elmt) {
-  struct vm_rg_struct *rg_node = mm->mmap->vm_freerg_list;
+struct vm_area_struct *get_vma_by_num(struct mm_struct *mm, int vmaid) {
+  if (vmaid < 0 || vmaid >= PAGING_MAX_VMA)
+    return NULL;
 
-  if (rg_elmt->rg_start >= rg_elmt->rg_end)
-    return -1;
+  return mm->vmatbl[vmaid];
+}
 
-  if (rg_node != NULL)
-    rg_elmt->rg_next = rg_node;
+#ifdef MM_XLATE_CACHE
+/*xlate_lookup - find the cached translation of a region offset
+ *@caller: caller, its mm locked
+ *@rgid: memory region ID
+ *@offset: offset in the region
+ *
+ */
+static struct xlate_entry_struct *xlate_lookup(struct pcb_t *caller, int rgid,
+                                               int offset) {
+  int i;
 
-  /* Enlist the new region */
-  mm->mmap->vm_freerg_list = rg_elmt;
+  for (i = 0; i < MM_XLATE_CACHE; i++)
+    if (caller->xlc[i].rgid == rgid &&
+        (unsigned long)(offset - caller->xlc[i].off_lo) < PAGING_PAGESZ)
+      return &caller->xlc[i];
 
-  return 0;
+  return NULL;
 }
 
-/*get_vma_by_num - get vm area by numID
- *@mm: memory region
- *@vmaid: ID vm area to alloc memory region
+/*xlate_fill - cache the translation of a region page
+ *@caller: caller, its mm locked
+ *@rgid: memory region ID
+ *@rg: region of @rgid
+ *@offset: offset in the region just accessed
  *
+ * The PTE is read again, the page may have moved since it was accessed
  */
-struct vm_area_struct *get_vma_by_num(struct mm_struct *mm, int vmaid) {
-  struct vm_area_struct *pvma = mm->mmap;
-
-  if (mm->mmap == NULL)
-    return NULL;
-
-  int vmait = 0;
+static void xlate_fill(struct pcb_t *caller, int rgid, struct vm_rg_struct *rg,
+                       int offset) {
+  int addr = rg->rg_start + offset;
+  int pgn = PAGING_PGN(addr);
+  pte_t pte = pte_get(caller->mm, pgn);
+  struct xlate_entry_struct *xe = xlate_lookup(caller, rgid, offset);
 
-  while (vmait < vmaid) {
-    if (pvma == NULL)
-      return NULL;
+  if (!PAGING_PAGE_ONLINE(pte))
+    return;
 
-    vmait++;
-    pvma = pvma->vm_next;
+  if (xe == NULL) {
+    xe = &caller->xlc[caller->xlc_next];
+    caller->xlc_next = (caller->xlc_next + 1) % MM_XLATE_CACHE;
   }
+  xe->rgid = rgid;
+  xe->pgn = pgn;
+  xe->off_lo = (long)pgn * PAGING_PAGESZ - (long)rg->rg_start;
+  xe->fbase = PAGING_PHYADDR(PAGING_FPN(pte), 0);
+  xe->writable = PAGING_PAGE_WRITABLE(pte) != 0;
+}
+
+/*xlate_inval - drop the cached translations of a page range
+ *@mm: memory region, locked by the caller
+ *@pgn_start: first page
+ *@pgn_end: first page after the range
+ *
+ * Called wherever the frame or the protection of a page changes
+ */
+void xlate_inval(struct mm_struct *mm, int pgn_start, int pgn_end) {
+  int i;
 
-  return pvma;
+  for (i = 0; mm->xlc != NULL && i < MM_XLATE_CACHE; i++)
+    if (mm->xlc[i].pgn >= pgn_start && mm->xlc[i].pgn < pgn_end)
+      mm->xlc[i].rgid = -1;
 }
 
-/*get_symrg_byid - get mem region by region ID
- *@mm: memory region
- *@rgid: region ID act as symbol index of variable
+/*xlate_inval_rgid - drop the cached translations of a region
+ *@mm: memory region, locked by the caller
+ *@rgid: memory region ID
  *
  */
-struct vm_rg_struct *get_symrg_byid(struct mm_struct *mm, int rgid) {
-  if (rgid < 0 || rgid > PAGING_MAX_SYMTBL_SZ)
-    return NULL;
+static void xlate_inval_rgid(struct mm_struct *mm, int rgid) {
+  int i;
 
-  return &mm->symrgtbl[rgid];
+  for (i = 0; i < MM_XLATE_CACHE; i++)
+    if (mm->xlc[i].rgid == rgid)
+      mm->xlc[i].rgid = -1;
 }
+#endif
 
 /*__alloc - allocate a region memory
  *@caller: caller
@@ -78,49 +114,62 @@ int __alloc(struct pcb_t *process, int vma_id, int region_id, int memory_size,
 
   // Kiểm tra và giải phóng vùng nhớ nếu cần thiết
 
-  if (process->mm->symrgtbl[region_id].rg_start <
-      process->mm->symrgtbl[region_id].rg_end) {
+  struct vm_rg_struct *symrg = set_symrg_byid(process->mm, region_id);
+
+  if (symrg == NULL)
+    return -1;
+
+  if (symrg->rg_start < symrg->rg_end) {
     pgfree_data(process, region_id);
   }
 
   // Khởi tạo và lấy thông tin cần thiết
 
-  struct vm_rg_struct *new_region = malloc(sizeof(struct vm_rg_struct));
+  struct vm_rg_struct new_region;
   struct vm_area_struct *current_vma = get_vma_by_num(process->mm, vma_id);
 
   //Đi tìm vùng trống và cấp phát bộ nhớ từ vùng trống hiện có
 
-  if (get_free_vmrg_area(process, vma_id, memory_size, new_region) == 0) {
-    process->mm->symrgtbl[region_id].rg_start = new_region->rg_start;
-    process->mm->symrgtbl[region_id].rg_end = new_region->rg_end;
-    *allocated_address = new_region->rg_start;
+  if (get_free_vmrg_area(process, vma_id, memory_size, &new_region) == 0) {
+    symrg->rg_start = new_region.rg_start;
+    symrg->rg_end = new_region.rg_end;
+    *allocated_address = new_region.rg_start;
+    process->mm->stat.rg_alloc++;
+    process->mm->stat.rg_reuse++;
     return 0;
   }
 
-  /* TODO get_free_vmrg_area FAILED handle the region management (Fig.6)*/
-
   // Tăng giới hạn vùng nhớ để tạo không gian
 
-  int increased_size = PAGING_PAGE_ALIGNSZ(memory_size);
   int previous_sbrk = current_vma->sbrk;
+  int pad = 0;
+
+#ifdef MM_HUGEPAGE
+  /* Start a region spanning a huge page on a huge page boundary so it
+   * can be mapped huge, the gap below goes to the free bins */
+  if (memory_size >= PAGING_HPAGESZ)
+    pad = (PAGING_HPAGESZ - previous_sbrk % PAGING_HPAGESZ) % PAGING_HPAGESZ;
+#endif
+  int increased_size = PAGING_PAGE_ALIGNSZ(pad + memory_size);
 
   if (inc_vma_limit(process, vma_id, increased_size) < 0) {
     printf("Unable to increase the limit\n");
     return -1;
   }
 
-  // if (inc_sz > size) {
-  //   struct vm_rg_struct *rgnode =
-  //       init_vm_rg(size + old_sbrk + 1, inc_sz + old_sbrk);
-  //   enlist_vm_freerg_list(caller->mm, rgnode);
-  // }
+  /* The alignment gap and the rest of the last page are mapped as well,
+   * keep them for later allocations */
+  vmrg_free(current_vma, previous_sbrk, previous_sbrk + pad);
+  vmrg_free(current_vma, previous_sbrk + pad + memory_size,
+            previous_sbrk + increased_size);
 
   // Cập nhật giá trị sbrk và thông tin vùng nhớ mới
   current_vma->sbrk += increased_size;
-  process->mm->symrgtbl[region_id].rg_start = previous_sbrk;
-  process->mm->symrgtbl[region_id].rg_end = previous_sbrk + memory_size;
+  symrg->rg_start = previous_sbrk + pad;
+  symrg->rg_end = previous_sbrk + pad + memory_size;
 
-  *allocated_address = previous_sbrk;
+  *allocated_address = previous_sbrk + pad;
+  process->mm->stat.rg_alloc++;
   return 0;
 }
 
@@ -133,15 +182,25 @@ int __alloc(struct pcb_t *process, int vma_id, int region_id, int memory_size,
  */
 int __free(struct pcb_t *process, int vma_id, int region_id) {
   struct vm_rg_struct *region_node = get_symrg_byid(process->mm, region_id);
-  // struct vm_area_struct * curr_vma = get_vma_by_num(caller->mm, vmaid);
+  struct vm_area_struct *current_vma = get_vma_by_num(process->mm, vma_id);
 
-  if (region_id < 0 || region_id > PAGING_MAX_SYMTBL_SZ)
+  if (region_node == NULL || current_vma == NULL)
     return -1;
 
-  /* TODO: Manage the collect freed region to freerg_list */
+  if (region_node->rg_start >= region_node->rg_end)
+    return -1; /* not allocated */
 
-  /*enlist the obsoleted memory region */
-  enlist_vm_freerg_list(process->mm, region_node);
+#ifdef MM_XLATE_CACHE
+  pthread_mutex_lock(MM_LOCKP(process->mm));
+  xlate_inval_rgid(process->mm, region_id);
+  pthread_mutex_unlock(MM_LOCKP(process->mm));
+#endif
+
+  /* Coalesce the obsoleted range into the free bins, the symbol no
+   * longer owns it */
+  vmrg_free(current_vma, region_node->rg_start, region_node->rg_end);
+  region_node->rg_start = region_node->rg_end = 0;
+  process->mm->stat.rg_free++;
   return 0;
 }
 
@@ -173,61 +232,239 @@ int pgfree_data(struct pcb_t *proc, uint32_t reg_index) {
  *@framenum: return FPN
  *@caller: caller
  *
+ * Caller must hold the mm lock until it is done with the returned frame
  */
 int pg_getpage(struct mm_struct *mm, int page_num, int *frame_num,
                struct pcb_t *pcb) {
-  uint32_t page_entry = mm->pgd[page_num];
+  pte_t *pte = pte_lookup(mm, page_num);
+
+  if (pte == NULL)
+    return -1; /* never mapped */
 
-  if (!PAGING_PAGE_PRESENT(
-          page_entry)) { /* Page is not online, make it actively living */
-    int victim_page_num, swap_frame_num;
+  if (PAGING_PAGE_SWAPPED(*pte)) { /* Page is not online, make it actively living */
     int victim_frame_num;
-    uint32_t victim_page_entry;
 
-    int target_frame_num =
-        PAGING_SWP(page_entry); // the target frame storing our variable
-    // int free_frame_num;         // finding free frame in RAM
+    if (alloc_frame(pcb, &victim_frame_num) < 0)
+      return -1;
 
-    /* TODO: Play with your paging theory here */
+    /* The mm lock may have been let go, the page faulted in meanwhile */
+    pte = pte_lookup(mm, page_num);
+    if (!PAGING_PAGE_SWAPPED(*pte)) {
+      MEMPHY_put_freefp(pcb->mram, victim_frame_num);
+      return pg_getpage(mm, page_num, frame_num, pcb);
+    }
 
-    /* Find victim page */
-    find_victim_page(pcb->mm, &victim_page_num);
-  
+    __swap_in_page(mm, pcb->mram, pcb->active_mswp, page_num,
+                   victim_frame_num);
+    mm->stat.fault++;
 
-    victim_page_entry = pcb->mm->pgd[victim_page_num];
-    victim_frame_num = PAGING_FPN(victim_page_entry);
+    /* No TLB holds the page, it was shot down when swapped out */
 
-    /* Get free frame in MEMSWP */
-    if (MEMPHY_get_freefp(pcb->active_mswp, &swap_frame_num) < 0) {
-      printf("Not enough space in swap\n");
-      return -1;
-    }
+#ifdef MM_SWAP_READAHEAD
+    swap_readahead(mm, page_num, pcb);
+#endif
+#ifdef MM_HUGEPAGE
+    hpage_promote(mm, page_num, pcb);
+#endif
+    pte = pte_lookup(mm, page_num); /* may have moved into the IPT */
+  }
+#ifdef MM_SWAP_READAHEAD
+  else if (*pte & PAGING_PTE_RAHEAD_MASK) {
+    /* First touch of a page brought in ahead, widen the window */
+    CLRBIT(*pte, PAGING_PTE_RAHEAD_MASK);
+    mm->stat.ra_hit++;
+    if (mm->ra_win < MM_SWAP_READAHEAD)
+      mm->ra_win++;
+#ifdef MM_HUGEPAGE
+    hpage_promote(mm, page_num, pcb);
+    pte = pte_lookup(mm, page_num);
+#endif
+  }
+#endif
+
+  *frame_num = PAGING_FPN(*pte);
+  return 0;
+}
 
-    __swap_cp_page(pcb->mram, victim_frame_num, pcb->active_mswp,
-                   swap_frame_num);
+/*__swap_in_page - copy a swapped page back into a MEMRAM frame
+ *@mm: owner of the page
+ *@mram: MEMRAM
+ *@mswp: MEMSWP holding the page
+ *@pgn: swapped page number
+ *@fpn: free frame to load the page into
+ *
+ */
+int __swap_in_page(struct mm_struct *mm, struct memphy_struct *mram,
+                   struct memphy_struct *mswp, int pgn, int fpn) {
+  int swpfpn = PAGING_SWP(pte_get(mm, pgn));
 
-    /* Copy target frame from swap to mem */
-    __swap_cp_page(pcb->active_mswp, target_frame_num, pcb->mram,
-                   victim_frame_num);
+  /* Copy target frame from swap to mem */
+#ifdef MM_ZSWAP
+  if (zswap_load(mswp->zswap, swpfpn, mram, fpn) < 0)
+#endif
+    __swap_cp_page(mswp, swpfpn, mram, fpn);
+  mm->stat.swpin++;
 
-    MEMPHY_put_freefp(pcb->active_mswp, target_frame_num);
+  /* The swap copy stays valid until the page gets dirty, keep the slot
+   * so a clean eviction needs no write back */
+  *pte_swpslot(mm, pgn) = swpfpn;
 
-    /* Update page table */
-    pte_set_swap(&pcb->mm->pgd[victim_page_num], 0, swap_frame_num);
-    pte_set_fpn(&mm->pgd[page_num], victim_frame_num);
+  /* Update page table */
+  pte_set_fpn(mm, pgn, fpn);
+  MEMPHY_set_rmap(mram, fpn, mm, pgn);
 
-#ifdef CPU_TLB
-    /* Update its online status of TLB (if needed) */
+  enlist_pgn_node(&mm->fifo_pgn, pgn);
+
+  return 0;
+}
+
+#ifdef MM_ZERO_PAGE
+/*do_cow_page - give a copy-on-write page its private frame
+ *@mm: memory region
+ *@pgn: page number being stored to
+ *@caller: caller
+ *
+ */
+int do_cow_page(struct mm_struct *mm, int pgn, struct pcb_t *caller) {
+  struct memphy_struct *mram = caller->mram;
+  pte_t *pte = pte_lookup(mm, pgn);
+  int oldfpn = PAGING_FPN(*pte);
+  struct framephy_struct *oldfp = &mram->frmtbl[oldfpn];
+  int newfpn;
+
+  mm->stat.fault++;
+  if (oldfpn != mram->zero_fpn) {
+    MEMPHY_lock_frame(mram, oldfpn);
+    if (oldfp->mapcount == 1) {
+      /* Last mapping of a merged frame, just take it over */
+      CLRBIT(*pte, PAGING_PTE_COW_MASK);
+      oldfp->owner = mm;
+      oldfp->pgn = pgn;
+      MEMPHY_unlock_frame(mram, oldfpn);
+      delist_pgn_node(&mm->fifo_pgn, pgn);
+      enlist_pgn_node(&mm->fifo_pgn, pgn);
+#ifdef MM_HUGEPAGE
+      hpage_promote(mm, pgn, caller);
 #endif
+      return 0;
+    }
+    MEMPHY_unlock_frame(mram, oldfpn);
+  }
+
+  if (alloc_frame(caller, &newfpn) < 0)
+    return -1;
+
+  /* alloc_frame may have evicted this very page */
+  pte = pte_lookup(mm, pgn);
+  if (!PAGING_PAGE_ONLINE(*pte)) {
+    MEMPHY_put_freefp(mram, newfpn);
+    return pg_getpage(mm, pgn, &newfpn, caller);
+  }
+  /* or let go of the mm lock while ksmd merged it again */
+  if (PAGING_FPN(*pte) != oldfpn || !(*pte & PAGING_PTE_COW_MASK)) {
+    MEMPHY_put_freefp(mram, newfpn);
+    return (*pte & PAGING_PTE_COW_MASK) ? do_cow_page(mm, pgn, caller) : 0;
+  }
 
-    enlist_pgn_node(&pcb->mm->fifo_pgn, page_num);
-    
-    //return 0;
+  __swap_cp_page(mram, oldfpn, mram, newfpn);
+  if (oldfpn != mram->zero_fpn) {
+    MEMPHY_lock_frame(mram, oldfpn);
+    oldfp->mapcount--;
+    if (oldfp->owner == mm && oldfp->pgn == pgn)
+      oldfp->owner = NULL;
+    MEMPHY_unlock_frame(mram, oldfpn);
   }
 
-  *frame_num = PAGING_FPN(page_entry);
+  pte_set_fpn(mm, pgn, newfpn);
+  CLRBIT(*pte, PAGING_PTE_COW_MASK); /* the new frame is private */
+  MEMPHY_set_rmap(mram, newfpn, mm, pgn);
+#ifdef CPU_TLB
+  /* Translations still point to the shared frame */
+  tlb_shootdown(mm, pgn, pgn + 1);
+#endif
+#ifdef MM_XLATE_CACHE
+  xlate_inval(mm, pgn, pgn + 1);
+#endif
+  delist_pgn_node(&mm->fifo_pgn, pgn);
+  enlist_pgn_node(&mm->fifo_pgn, pgn);
+  mm->stat.cow++;
+#ifdef MM_HUGEPAGE
+  /* The last private page of a span completes it */
+  hpage_promote(mm, pgn, caller);
+#endif
+
   return 0;
 }
+#endif
+
+#ifdef MM_SWAP_READAHEAD
+/*swap_readahead - bring in the swapped pages following a faulting one
+ *@mm: memory region
+ *@pgn: faulting page number
+ *@caller: caller
+ *
+ * Up to ra_win next pages of the same vm area are read while MEMRAM has
+ * free frames, readahead never evicts to make room.
+ */
+int swap_readahead(struct mm_struct *mm, int pgn, struct pcb_t *caller) {
+  struct vm_area_struct *vma;
+  int pgit, fpn, nr_ra = 0;
+  pte_t *pte;
+
+  /* Locate the vm area holding the faulting page */
+  vma = find_vma(mm, (unsigned long)pgn * PAGING_PAGESZ);
+  if (vma == NULL)
+    return 0;
+
+  for (pgit = pgn + 1;
+       pgit <= pgn + mm->ra_win && pgit * PAGING_PAGESZ < vma->vm_end;
+       pgit++) {
+    pte = pte_lookup(mm, pgit);
+    if (pte == NULL || !PAGING_PAGE_SWAPPED(*pte))
+      continue;
+
+    if (MEMPHY_get_freefp(caller->mram, &fpn) < 0)
+      break;
+
+    __swap_in_page(mm, caller->mram, caller->active_mswp, pgit, fpn);
+    SETBIT(*pte_lookup(mm, pgit), PAGING_PTE_RAHEAD_MASK);
+    nr_ra++;
+  }
+  mm->stat.ra_issued += nr_ra;
+
+  return nr_ra;
+}
+#endif
+
+#ifdef CPU_TLB
+/*pg_tlb_refill - cache the translation of a page just walked
+ *@caller: caller, its mm lock is held
+ *@mm: memory region
+ *@pgn: page number
+ *@fpn: frame number the page is mapped on
+ *
+ * A page of a huge page is cached as the whole huge page
+ */
+static void pg_tlb_refill(struct pcb_t *caller, struct mm_struct *mm, int pgn,
+                          int fpn) {
+  pte_t pte = pte_get(mm, pgn);
+
+  if (caller->tlb == NULL)
+    return;
+
+#ifdef MM_HUGEPAGE
+  if (pte & PAGING_PTE_HUGE_MASK) {
+    tlb_cache_write_hpage(caller, caller->tlb, pgn, fpn,
+                          PAGING_PAGE_WRITABLE(pte));
+    return;
+  }
+#endif
+  tlb_cache_write(caller, caller->tlb, pgn, fpn, PAGING_PAGE_WRITABLE(pte));
+#ifdef CPUTLB_PREFETCH
+  tlb_prefetch(caller, pgn);
+#endif
+}
+#endif
 
 /*pg_getval - read value at given offset
  *@mm: memory region
@@ -241,13 +478,21 @@ int pg_getval(struct mm_struct *mm, int addr, BYTE *data,
   int off = PAGING_OFFST(addr);
   int fpn;
 
+  pthread_mutex_lock(MM_LOCKP(mm));
   /* Get the page to MEMRAM, swap from MEMSWAP if needed */
-  if (pg_getpage(mm, pgn, &fpn, caller) != 0)
+  if (pg_getpage(mm, pgn, &fpn, caller) != 0) {
+    pthread_mutex_unlock(MM_LOCKP(mm));
     return -1; /* invalid page access */
+  }
 
-  int phyaddr = (fpn << PAGING_ADDR_FPN_LOBIT) + off;
+  paddr_t phyaddr = PAGING_PHYADDR(fpn, off);
 
   MEMPHY_read(caller->mram, phyaddr, data);
+#ifdef CPU_TLB
+  /* Refill from this walk, under the mm lock to order with shootdowns */
+  pg_tlb_refill(caller, mm, pgn, fpn);
+#endif
+  pthread_mutex_unlock(MM_LOCKP(mm));
 
   return 0;
 }
@@ -264,13 +509,36 @@ int pg_setval(struct mm_struct *mm, int addr, BYTE value,
   int off = PAGING_OFFST(addr);
   int fpn;
 
+  pthread_mutex_lock(MM_LOCKP(mm));
   /* Get the page to MEMRAM, swap from MEMSWAP if needed */
-  if (pg_getpage(mm, pgn, &fpn, caller) != 0)
+  if (pg_getpage(mm, pgn, &fpn, caller) != 0) {
+    pthread_mutex_unlock(MM_LOCKP(mm));
     return -1; /* invalid page access */
+  }
 
-  int phyaddr = (fpn << PAGING_ADDR_FPN_LOBIT) + off;
+#ifdef MM_ZERO_PAGE
+  /* Store to a shared frame, break copy-on-write first */
+  if ((pte_get(mm, pgn) & PAGING_PTE_COW_MASK) &&
+      (do_cow_page(mm, pgn, caller) < 0 ||
+       pg_getpage(mm, pgn, &fpn, caller) != 0)) {
+    pthread_mutex_unlock(MM_LOCKP(mm));
+    return -1;
+  }
+#endif
+
+  paddr_t phyaddr = PAGING_PHYADDR(fpn, off);
 
   MEMPHY_write(caller->mram, phyaddr, value);
+#ifdef MM_HUGEPAGE
+  if (pte_get(mm, pgn) & PAGING_PTE_HUGE_MASK)
+    hpage_set_dirty(mm, pgn);
+  else
+#endif
+    PAGING_PTE_SET_DIRTY(*pte_lookup(mm, pgn));
+#ifdef CPU_TLB
+  pg_tlb_refill(caller, mm, pgn, fpn);
+#endif
+  pthread_mutex_unlock(MM_LOCKP(mm));
 
   return 0;
 }
@@ -282,8 +550,24 @@ int pg_setval(struct mm_struct *mm, int addr, BYTE value,
  *@rgid: memory region ID (used to identify variable in symbole table)
  *@size: allocated size
  *
+ * A repeated access to a page of the region is served by the translation
+ * cache of the caller, other accesses walk the page table
  */
 int __read(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE *data) {
+#ifdef MM_XLATE_CACHE
+  struct xlate_entry_struct *xe;
+
+  pthread_mutex_lock(MM_LOCKP(caller->mm));
+  xe = xlate_lookup(caller, rgid, offset);
+  if (xe != NULL) {
+    MEMPHY_read(caller->mram, xe->fbase + (offset - xe->off_lo), data);
+    caller->mm->stat.xlc_hit++;
+    pthread_mutex_unlock(MM_LOCKP(caller->mm));
+    return 0;
+  }
+  pthread_mutex_unlock(MM_LOCKP(caller->mm));
+#endif
+
   struct vm_rg_struct *currg = get_symrg_byid(caller->mm, rgid);
 
   struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
@@ -291,7 +575,16 @@ int __read(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE *data) {
   if (currg == NULL || cur_vma == NULL) /* Invalid memory identify */
     return -1;
 
-  pg_getval(caller->mm, currg->rg_start + offset, data, caller);
+  if (pg_getval(caller->mm, currg->rg_start + offset, data, caller) < 0)
+    return -1;
+
+#ifdef MM_XLATE_CACHE
+  pthread_mutex_lock(MM_LOCKP(caller->mm));
+  caller->mm->stat.xlc_miss++;
+  if (currg->rg_start < currg->rg_end)
+    xlate_fill(caller, rgid, currg, offset);
+  pthread_mutex_unlock(MM_LOCKP(caller->mm));
+#endif
 
   return 0;
 }
@@ -323,8 +616,23 @@ int pgread(struct pcb_t *proc, // Process executing the instruction
  *@rgid: memory region ID (used to identify variable in symbole table)
  *@size: allocated size
  *
+ * Only translations of private, already dirty pages serve stores
  */
 int __write(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE value) {
+#ifdef MM_XLATE_CACHE
+  struct xlate_entry_struct *xe;
+
+  pthread_mutex_lock(MM_LOCKP(caller->mm));
+  xe = xlate_lookup(caller, rgid, offset);
+  if (xe != NULL && xe->writable) {
+    MEMPHY_write(caller->mram, xe->fbase + (offset - xe->off_lo), value);
+    caller->mm->stat.xlc_hit++;
+    pthread_mutex_unlock(MM_LOCKP(caller->mm));
+    return 0;
+  }
+  pthread_mutex_unlock(MM_LOCKP(caller->mm));
+#endif
+
   struct vm_rg_struct *currg = get_symrg_byid(caller->mm, rgid);
 
   struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
@@ -332,7 +640,16 @@ int __write(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE value) {
   if (currg == NULL || cur_vma == NULL) /* Invalid memory identify */
     return -1;
 
-  pg_setval(caller->mm, currg->rg_start + offset, value, caller);
+  if (pg_setval(caller->mm, currg->rg_start + offset, value, caller) < 0)
+    return -1;
+
+#ifdef MM_XLATE_CACHE
+  pthread_mutex_lock(MM_LOCKP(caller->mm));
+  caller->mm->stat.xlc_miss++;
+  if (currg->rg_start < currg->rg_end)
+    xlate_fill(caller, rgid, currg, offset);
+  pthread_mutex_unlock(MM_LOCKP(caller->mm));
+#endif
 
   return 0;
 }
@@ -353,25 +670,86 @@ int pgwrite(struct pcb_t *proc,   // Process executing the instruction
   return __write(proc, 0, destination, offset, data);
 }
 
-/*free_pcb_memphy - collect all memphy of pcb
- *@caller: caller
- *@vmaid: ID vm area to alloc memory region
- *@incpgnum: number of page
+/*free_pte_memph - give back the frame and swap slot behind a PTE
+ *@mm: memory region, locked by the caller
+ *@pgn: page number
+ *@pte: page table entry
+ *@arg: caller
+ *
+ * A merged frame is only released by its last mapping, the zero frame
+ * never is. The reverse mapping is cleared under the frame lock so that
+ * kswapd and ksmd stop finding the mm before it goes away
  */
-int free_pcb_memph(struct pcb_t *caller) {
-  int pagenum, fpn;
-  uint32_t pte;
+static int free_pte_memph(struct mm_struct *mm, int pgn, pte_t *pte,
+                          void *arg) {
+  struct pcb_t *caller = arg;
+  struct memphy_struct *mram = caller->mram;
+  struct framephy_struct *fp;
+  int *swpslot, fpn, last;
+
+  if (PAGING_PAGE_SWAPPED(*pte)) {
+    /* The slot is referenced by the swapped PTE only */
+    fpn = PAGING_SWP(*pte);
+#ifdef MM_ZSWAP
+    zswap_invalidate(caller->active_mswp->zswap, fpn);
+#endif
+    MEMPHY_put_freefp(caller->active_mswp, fpn);
+    return 0;
+  }
 
-  for (pagenum = 0; pagenum < PAGING_MAX_PGN; pagenum++) {
-    pte = caller->mm->pgd[pagenum];
+  if (!PAGING_PAGE_PRESENT(*pte))
+    return 0;
 
-    if (!PAGING_PAGE_PRESENT(pte)) {
-      fpn = PAGING_FPN(pte);
-      MEMPHY_put_freefp(caller->mram, fpn);
-    } else {
-      fpn = PAGING_SWP(pte);
-      MEMPHY_put_freefp(caller->active_mswp, fpn);
-    }
+  /* A clean page may still keep its copy in swap */
+  swpslot = pte_swpslot(mm, pgn);
+  if (swpslot != NULL && *swpslot >= 0) {
+#ifdef MM_ZSWAP
+    zswap_invalidate(caller->active_mswp->zswap, *swpslot);
+#endif
+    MEMPHY_put_freefp(caller->active_mswp, *swpslot);
+    *swpslot = -1;
+  }
+
+  fpn = PAGING_FPN(*pte);
+  if (fpn == mram->zero_fpn)
+    return 0;
+
+  fp = &mram->frmtbl[fpn];
+  MEMPHY_lock_frame(mram, fpn);
+  if (fp->owner == mm && fp->pgn == pgn) {
+    fp->owner = NULL;
+    fp->pgn = -1;
+  }
+  last = (--fp->mapcount <= 0);
+  MEMPHY_unlock_frame(mram, fpn);
+
+  if (last)
+    MEMPHY_put_freefp(mram, fpn);
+
+  return 0;
+}
+
+/*free_pcb_memph - give back all the frames and swap slots of a pcb
+ *@caller: caller, its mm lock is held
+ *
+ * Only the pages of the vm areas are walked, in IPT mode their online
+ * PTEs come from the IPT entry list of the mm
+ */
+int free_pcb_memph(struct pcb_t *caller) {
+  struct vm_area_struct *vma;
+  unsigned long last;
+  int ret;
+
+  for (vma = caller->mm->mmap; vma != NULL; vma = vma->vm_next) {
+    if (vma->vm_start >= vma->vm_end)
+      continue;
+
+    /* The last page is mapped whole even if the area ends inside it */
+    last = vma->vm_end - 1;
+    ret = pt_walk(caller->mm, PAGING_PGN(vma->vm_start), PAGING_PGN(last) + 1,
+                  free_pte_memph, caller);
+    if (ret != 0)
+      return ret;
   }
 
   return 0;
@@ -407,24 +785,11 @@ struct vm_rg_struct *get_vm_area_node_at_brk(struct pcb_t *caller, int vmaid,
  */
 int validate_overlap_vm_area(struct pcb_t *process, int vma_id, int start_addr,
                              int end_addr) {
-  struct vm_area_struct *current_vma = process->mm->mmap;
-
-  /* TODO validate the planned memory area is not overlapped */
-
-  while (current_vma != NULL) {
-    if (vma_id != current_vma->vm_id) {
-      if (OVERLAP(start_addr, end_addr, current_vma->vm_start,
-                  current_vma->vm_end)) {
-        if ((start_addr != current_vma->vm_end ||
-             end_addr == current_vma->vm_start) &&
-            (start_addr == current_vma->vm_end ||
-             end_addr != current_vma->vm_start)) {
-          return -1;
-        }
-      }
-    }
-    current_vma = current_vma->vm_next;
-  }
+  /* The area being grown may touch its own range only */
+  if (vma_find_overlap(process->mm, start_addr, end_addr,
+                       get_vma_by_num(process->mm, vma_id)) != NULL)
+    return -1;
+
   return 0;
 }
 
@@ -435,7 +800,7 @@ int validate_overlap_vm_area(struct pcb_t *process, int vma_id, int start_addr,
  *
  */
 int inc_vma_limit(struct pcb_t *caller, int vmaid, int inc_sz) {
-  struct vm_rg_struct *newrg = malloc(sizeof(struct vm_rg_struct));
+  struct vm_rg_struct newrg;
   int inc_amt = PAGING_PAGE_ALIGNSZ(inc_sz);
   int incnumpage = inc_amt / PAGING_PAGESZ;
   struct vm_rg_struct *area =
@@ -443,107 +808,294 @@ int inc_vma_limit(struct pcb_t *caller, int vmaid, int inc_sz) {
   struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
 
   int old_end = cur_vma->vm_end;
+  int ret = 0;
 
   /*Validate overlap of obtained region */
-  if (validate_overlap_vm_area(caller, vmaid, area->rg_start, area->rg_end) < 0)
+  if (validate_overlap_vm_area(caller, vmaid, area->rg_start, area->rg_end) <
+      0) {
+    free(area);
     return -1; /*Overlap and failed allocation */
+  }
 
   /* The obtained vm area (only)
    * now will be alloc real ram region */
-  cur_vma->vm_end += inc_sz;
+  vma_set_end(caller->mm, cur_vma, cur_vma->vm_end + inc_sz);
   if (vm_map_ram(caller, area->rg_start, area->rg_end, old_end, incnumpage,
-                 newrg) < 0)
-    return -1; /* Map the memory to MEMRAM */
+                 &newrg) < 0)
+    ret = -1; /* Map the memory to MEMRAM */
 
-  return 0;
+  free(area);
+  return ret;
 }
 
 /*find_victim_page - find victim page
- *@caller: caller
+ *@mm: memory region, locked by the caller
  *@pgn: return page number
  *
+ * FIFO: the oldest page at the tail of fifo_pgn goes first. Pages on the
+ * zero frame never get on the list, merged pages stay on it and only
+ * drop their mapping of the shared frame when evicted, a huge page is
+ * split by the eviction. Entries of pages gone offline are discarded.
  */
 int find_victim_page(struct mm_struct *mm, int *victim_page) {
   struct pgn_t *page = mm->fifo_pgn;
   struct pgn_t *page_prev = NULL;
 
-  /* TODO: Implement the theorical mechanism to find the victim page */
-  if (page == NULL) {
-    *victim_page = -1;
-    return -1;
+  while (page != NULL) {
+    page_prev = NULL;
+    while (page->pg_next != NULL) {
+      page_prev = page;
+      page = page->pg_next;
+    }
+
+    if (page_prev == NULL) {
+      mm->fifo_pgn = NULL;
+    } else {
+      page_prev->pg_next = NULL;
+    }
+
+    *victim_page = page->pgn;
+    free(page);
+
+    /* Skip pages no longer online */
+    if (PAGING_PAGE_ONLINE(pte_get(mm, *victim_page)))
+      return 0;
+
+    page = mm->fifo_pgn;
   }
 
-  while (page->pg_next != NULL) {
-    page_prev = page;
-    page = page->pg_next;
+  *victim_page = -1;
+  return -1;
+}
+
+/*swap_out_page - evict an online page to MEMSWP
+ *@caller: caller
+ *@vicpgn: victim page number
+ *@vicfpn: return the released frame number
+ *
+ * A clean page whose swap slot still holds a valid copy is dropped
+ * without write back, a dirty one is written back to its retained slot
+ * (or a fresh one).
+ */
+int swap_out_page(struct pcb_t *caller, int vicpgn, int *vicfpn) {
+  return __swap_out_page(caller->mm, caller->mram, caller->active_mswp,
+                         vicpgn, vicfpn);
+}
+
+/*__reclaim_frame - evict the page mapped on a frame of any mm
+ *@held: mm whose lock the caller already holds, NULL if none
+ *@mram: MEMRAM
+ *@mswp: MEMSWP to write back to
+ *@fpn: frame number
+ *
+ * The owner mm is only trylocked, a frame whose owner is faulting on
+ * another CPU is skipped rather than waited for. Return 0 if the frame
+ * was released, it is then off every list and belongs to the caller, 1
+ * if its owner was busy, -1 if it cannot be reclaimed
+ */
+int __reclaim_frame(struct mm_struct *held, struct memphy_struct *mram,
+                    struct memphy_struct *mswp, int fpn) {
+  struct framephy_struct *fp = &mram->frmtbl[fpn];
+  struct mm_struct *mm;
+  int pgn, vicfpn, locked = 0, ret = -1;
+
+  MEMPHY_lock_frame(mram, fpn);
+  mm = fp->owner;
+  pgn = fp->pgn;
+  if (mm == NULL || pgn < 0) {
+    MEMPHY_unlock_frame(mram, fpn);
+    return -1; /* free, shared only or not yet mapped */
   }
 
-  if (page_prev == NULL) {
-    mm->fifo_pgn = NULL;
-  } else {
-    page_prev->pg_next = NULL;
+  /* Taken before the frame lock is dropped: exit_mm clears the owner
+   * under both locks, so the mm cannot go away in between */
+  if (held == NULL || MM_LOCKP(mm) != MM_LOCKP(held)) {
+    if (pthread_mutex_trylock(MM_LOCKP(mm)) != 0) {
+      MEMPHY_unlock_frame(mram, fpn);
+      return 1;
+    }
+    locked = 1;
+  }
+  MEMPHY_unlock_frame(mram, fpn);
+
+  /* Skip a reverse mapping changed meanwhile or gone stale */
+  MEMPHY_lock_frame(mram, fpn);
+  if (fp->owner != mm || fp->pgn != pgn)
+    pgn = -1;
+  MEMPHY_unlock_frame(mram, fpn);
+
+  if (pgn >= 0 && PAGING_PAGE_ONLINE(pte_get(mm, pgn)) &&
+      PAGING_FPN(pte_get(mm, pgn)) == fpn) {
+    ret = __swap_out_page(mm, mram, mswp, pgn, &vicfpn);
+    if (ret >= 0)
+      delist_pgn_node(&mm->fifo_pgn, pgn);
   }
+  if (locked)
+    pthread_mutex_unlock(MM_LOCKP(mm));
 
-  *victim_page = page->pgn;
-  free(page);
+  /* A merged frame stays mapped by the other sharers */
+  return (ret == 0) ? 0 : -1;
+}
 
-  return 0;
+/*alloc_frame_reclaim - take a frame of any process
+ *@caller: caller, its mm lock is held
+ *@fpn: return frame number
+ *
+ * Other owners are only trylocked. When a whole scan met busy owners
+ * only, the caller's mm lock is let go while retrying so an owner
+ * waiting on it makes progress, the caller revalidates its page after.
+ * Fail only once a scan finds no busy owner, MEMRAM cannot be reclaimed
+ */
+static int alloc_frame_reclaim(struct pcb_t *caller, int *fpn) {
+  static unsigned int reclaim_hand = 0;
+  struct memphy_struct *mram = caller->mram;
+  struct mm_struct *held = caller->mm;
+  int nr_scan, nr_busy, ret = -1;
+
+  for (;;) {
+    nr_busy = 0;
+    for (nr_scan = 0; nr_scan < mram->maxfp && ret != 0; nr_scan++) {
+      *fpn = __atomic_fetch_add(&reclaim_hand, 1, __ATOMIC_RELAXED) %
+             mram->maxfp;
+      ret = __reclaim_frame(held, mram, caller->active_mswp, *fpn);
+      if (ret > 0)
+        nr_busy++;
+    }
+    if (ret == 0 || nr_busy == 0)
+      break;
+
+    if (held != NULL) {
+      pthread_mutex_unlock(MM_LOCKP(caller->mm));
+      held = NULL;
+    }
+    usleep(10);
+    /* kswapd or an exiting process may have freed a frame meanwhile */
+    if (MEMPHY_get_freefp(mram, fpn) == 0) {
+      pthread_mutex_lock(MM_LOCKP(caller->mm));
+      return 0;
+    }
+  }
+
+  if (held == NULL)
+    pthread_mutex_lock(MM_LOCKP(caller->mm));
+  if (ret == 0)
+    caller->mm->stat.reclaim++;
+  return ret;
 }
 
-/*get_free_vmrg_area - get a free vm region
+/*alloc_frame - get a free MEMRAM frame for the caller
  *@caller: caller
- *@vmaid: ID vm area to alloc memory region
- *@size: allocated size
+ *@fpn: return frame number
  *
+ * Take a free frame (kept available by kswapd) and only reclaim one of
+ * the caller's pages on the faulting path when MEMRAM is exhausted. A
+ * caller left without online pages takes a frame of another process,
+ * possibly letting go of its mm lock meanwhile, see alloc_frame_reclaim.
  */
-int get_free_vmrg_area(struct pcb_t *caller, int vmaid, int size,
-                       struct vm_rg_struct *newrg) {
-  struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
+int alloc_frame(struct pcb_t *caller, int *fpn) {
+  struct memphy_struct *mram = caller->mram;
+  int vicpgn, ret;
 
-  struct vm_rg_struct *rgit = cur_vma->vm_freerg_list;
+  if (MEMPHY_get_freefp(mram, fpn) == 0)
+    return 0;
 
-  if (rgit == NULL)
-    return -1;
+  do {
+    /* Find victim page */
+    if (find_victim_page(caller->mm, &vicpgn) < 0)
+      return alloc_frame_reclaim(caller, fpn);
 
-  /* Probe unintialized newrg */
-  newrg->rg_start = newrg->rg_end = -1;
-
-  /* Traverse on list of free vm region to find a fit space */
-  while (rgit != NULL) {
-    if (rgit->rg_start + size <=
-        rgit->rg_end) { /* Current region has enough space */
-      newrg->rg_start = rgit->rg_start;
-      newrg->rg_end = rgit->rg_start + size;
-
-      /* Update left space in chosen region */
-      if (rgit->rg_start + size < rgit->rg_end) {
-        rgit->rg_start = rgit->rg_start + size;
-      } else { /*Use up all space, remove current node */
-        /*Clone next rg node */
-        struct vm_rg_struct *nextrg = rgit->rg_next;
-
-        /*Cloning */
-        if (nextrg != NULL) {
-          rgit->rg_start = nextrg->rg_start;
-          rgit->rg_end = nextrg->rg_end;
-
-          rgit->rg_next = nextrg->rg_next;
-
-          free(nextrg);
-        } else {                         /*End of free list */
-          rgit->rg_start = rgit->rg_end; // dummy, size 0 region
-          rgit->rg_next = NULL;
-        }
-      }
-
-      // break;
-    } else {
-      rgit = rgit->rg_next; // Traverse next rg
+    ret = swap_out_page(caller, vicpgn, fpn);
+    if (ret < 0) {
+      printf("Not enough space in swap\n");
+      enlist_pgn_node(&caller->mm->fifo_pgn, vicpgn);
+      return -1;
     }
+  } while (ret > 0); /* frame still mapped by others, try next victim */
+
+  caller->mm->stat.reclaim++;
+  return 0;
+}
+
+/*__swap_out_page - evict an online page of any mm to MEMSWP
+ *@mm: owner of the victim page
+ *@mram: MEMRAM holding the victim frame
+ *@mswp: MEMSWP to write back to
+ *@vicpgn: victim page number
+ *@vicfpn: return the released frame number
+ *
+ * Return 1 if the page was unmapped but its frame is still shared by
+ * other mappings, so no frame is released
+ */
+int __swap_out_page(struct mm_struct *mm, struct memphy_struct *mram,
+                    struct memphy_struct *mswp, int vicpgn, int *vicfpn) {
+  pte_t *pte = pte_lookup(mm, vicpgn);
+  int *swpslot = pte_swpslot(mm, vicpgn);
+  pte_t vicpte;
+  int swpfpn = *swpslot;
+  int shared;
+
+#ifdef MM_HUGEPAGE
+  /* Only part of a huge page goes out, split it first */
+  if (*pte & PAGING_PTE_HUGE_MASK)
+    hpage_demote(mm, vicpgn);
+#endif
+  vicpte = *pte;
+
+  *vicfpn = PAGING_FPN(vicpte);
+
+#ifdef CPU_TLB
+  /* No CPU may reach the frame once its content is being copied out */
+  tlb_shootdown(mm, vicpgn, vicpgn + 1);
+#endif
+#ifdef MM_XLATE_CACHE
+  xlate_inval(mm, vicpgn, vicpgn + 1);
+#endif
+
+#ifdef MM_SWAP_READAHEAD
+  if (vicpte & PAGING_PTE_RAHEAD_MASK) {
+    /* Brought in ahead but never touched, shrink the window */
+    mm->stat.ra_waste++;
+    if (mm->ra_win > 1)
+      mm->ra_win /= 2;
+  }
+#endif
+
+  if (swpfpn >= 0 && !PAGING_PAGE_DIRTY(vicpte)) {
+    mm->stat.swpclean++;
+  } else {
+    if (swpfpn < 0 && MEMPHY_get_freefp(mswp, &swpfpn) < 0)
+      return -1;
+
+#ifdef MM_ZSWAP
+    if (zswap_store(mswp->zswap, mram, *vicfpn, swpfpn) < 0)
+#endif
+      __swap_cp_page(mram, *vicfpn, mswp, swpfpn);
+    mm->stat.swpout++;
+  }
+
+  /* The slot is now referenced by the swapped PTE itself, a copy-on-write
+   * page comes back on a private frame */
+  *swpslot = -1;
+  CLRBIT(*pte, PAGING_PTE_DIRTY_MASK);
+  CLRBIT(*pte, PAGING_PTE_COW_MASK);
+  pte_set_swap(mm, vicpgn, 0, swpfpn);
+
+  /* Frame no longer backs this page */
+  MEMPHY_lock_frame(mram, *vicfpn);
+  if (mram->frmtbl[*vicfpn].owner == mm &&
+      mram->frmtbl[*vicfpn].pgn == vicpgn) {
+    mram->frmtbl[*vicfpn].owner = NULL;
+    mram->frmtbl[*vicfpn].pgn = -1;
+  }
+  shared = (--mram->frmtbl[*vicfpn].mapcount > 0);
+  MEMPHY_unlock_frame(mram, *vicfpn);
+
+  /* Other mappings still use a merged frame, nothing is released */
+  if (shared) {
+    *vicfpn = -1;
+    return 1;
   }
 
-  if (newrg->rg_start == -1) // new region not found
-    return -1;
   return 0;
 }
 
@@ -0,0 +1,255 @@
+//#ifdef MM_PAGING
+/*
+ * PAGING based Memory Management
+ * Memory area tree mm/mm-vma.c
+ *
+ * The memory areas of an mm (heap, stack, shared, file backed) never
+ * overlap. They are kept in an AVL tree ordered by vm_start where every
+ * node also records the highest vm_end below it, which makes it an
+ * interval tree: the area holding an address and the areas overlapping
+ * a range are found in O(log n). The areas are also linked in address
+ * order through vm_next and indexed by ID in mm->vmatbl.
+ */
+
+#include "mm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int vma_height(struct vm_area_struct *vma) {
+  return (vma != NULL) ? vma->vm_height : 0;
+}
+
+/* Recompute the height and interval bound of a node from its children */
+static void vma_fix(struct vm_area_struct *vma) {
+  int hl = vma_height(vma->vm_left), hr = vma_height(vma->vm_right);
+
+  vma->vm_height = 1 + (hl > hr ? hl : hr);
+  vma->vm_subtree_end = vma->vm_end;
+  if (vma->vm_left != NULL &&
+      vma->vm_left->vm_subtree_end > vma->vm_subtree_end)
+    vma->vm_subtree_end = vma->vm_left->vm_subtree_end;
+  if (vma->vm_right != NULL &&
+      vma->vm_right->vm_subtree_end > vma->vm_subtree_end)
+    vma->vm_subtree_end = vma->vm_right->vm_subtree_end;
+}
+
+static struct vm_area_struct *vma_rotate_right(struct vm_area_struct *vma) {
+  struct vm_area_struct *l = vma->vm_left;
+
+  vma->vm_left = l->vm_right;
+  l->vm_right = vma;
+  vma_fix(vma);
+  vma_fix(l);
+  return l;
+}
+
+static struct vm_area_struct *vma_rotate_left(struct vm_area_struct *vma) {
+  struct vm_area_struct *r = vma->vm_right;
+
+  vma->vm_right = r->vm_left;
+  r->vm_left = vma;
+  vma_fix(vma);
+  vma_fix(r);
+  return r;
+}
+
+static struct vm_area_struct *vma_balance(struct vm_area_struct *vma) {
+  int bal;
+
+  vma_fix(vma);
+  bal = vma_height(vma->vm_left) - vma_height(vma->vm_right);
+
+  if (bal > 1) {
+    if (vma_height(vma->vm_left->vm_left) <
+        vma_height(vma->vm_left->vm_right))
+      vma->vm_left = vma_rotate_left(vma->vm_left);
+    return vma_rotate_right(vma);
+  }
+  if (bal < -1) {
+    if (vma_height(vma->vm_right->vm_right) <
+        vma_height(vma->vm_right->vm_left))
+      vma->vm_right = vma_rotate_right(vma->vm_right);
+    return vma_rotate_left(vma);
+  }
+
+  return vma;
+}
+
+static struct vm_area_struct *vma_insert(struct vm_area_struct *root,
+                                         struct vm_area_struct *vma) {
+  if (root == NULL) {
+    vma->vm_left = vma->vm_right = NULL;
+    vma_fix(vma);
+    return vma;
+  }
+
+  if (vma->vm_start < root->vm_start)
+    root->vm_left = vma_insert(root->vm_left, vma);
+  else
+    root->vm_right = vma_insert(root->vm_right, vma);
+
+  return vma_balance(root);
+}
+
+/* Refresh the interval bounds on the path down to an area */
+static void vma_fix_path(struct vm_area_struct *root,
+                         struct vm_area_struct *vma) {
+  if (root == NULL)
+    return;
+
+  if (root != vma)
+    vma_fix_path((vma->vm_start < root->vm_start) ? root->vm_left
+                                                  : root->vm_right,
+                 vma);
+  vma_fix(root);
+}
+
+static struct vm_area_struct *vma_overlap(struct vm_area_struct *node,
+                                          unsigned long start,
+                                          unsigned long end,
+                                          struct vm_area_struct *skip) {
+  struct vm_area_struct *found;
+
+  /* Nothing below ends after the range starts */
+  if (node == NULL || node->vm_subtree_end <= start)
+    return NULL;
+
+  found = vma_overlap(node->vm_left, start, end, skip);
+  if (found != NULL)
+    return found;
+
+  if (node != skip && node->vm_start < end && start < node->vm_end)
+    return node;
+
+  /* The right subtree starts at or after this node */
+  if (node->vm_start >= end)
+    return NULL;
+
+  return vma_overlap(node->vm_right, start, end, skip);
+}
+
+/*find_vma - get the vm area holding an address
+ *@mm: memory region
+ *@addr: virtual address
+ *
+ */
+struct vm_area_struct *find_vma(struct mm_struct *mm, unsigned long addr) {
+  struct vm_area_struct *vma = mm->vma_root;
+
+  while (vma != NULL) {
+    if (addr < vma->vm_start)
+      vma = vma->vm_left;
+    else if (addr < vma->vm_end)
+      return vma;
+    else
+      vma = vma->vm_right;
+  }
+
+  return NULL;
+}
+
+/*vma_find_overlap - get a vm area overlapping a range
+ *@mm: memory region
+ *@start: range start
+ *@end: range end, excluded
+ *@skip: area left out of the search, NULL for none
+ *
+ */
+struct vm_area_struct *vma_find_overlap(struct mm_struct *mm,
+                                        unsigned long start, unsigned long end,
+                                        struct vm_area_struct *skip) {
+  return vma_overlap(mm->vma_root, start, end, skip);
+}
+
+/*vma_create - add an empty vm area to an mm
+ *@mm: memory region
+ *@vmaid: ID of the new area
+ *@start: area start, it grows up from here with its sbrk
+ *@flags: VM_AREA_* kind of the area
+ *
+ * Return NULL if the ID is taken or @start lies in another area
+ */
+struct vm_area_struct *vma_create(struct mm_struct *mm, int vmaid,
+                                  unsigned long start, unsigned long flags) {
+  struct vm_area_struct *vma, *prev = NULL, *it;
+
+  if (vmaid < 0 || vmaid >= PAGING_MAX_VMA || mm->vmatbl[vmaid] != NULL ||
+      find_vma(mm, start) != NULL)
+    return NULL;
+
+  /* Areas are keyed on their start, two empty ones cannot share it */
+  for (it = mm->vma_root; it != NULL;) {
+    if (it->vm_start == start)
+      return NULL;
+    if (start < it->vm_start) {
+      it = it->vm_left;
+    } else {
+      prev = it;
+      it = it->vm_right;
+    }
+  }
+
+  vma = malloc(sizeof(struct vm_area_struct));
+  vma->vm_id = vmaid;
+  vma->vm_start = start;
+  vma->vm_end = start;
+  vma->vm_flags = flags;
+  vma->sbrk = start;
+  vma->vm_mm = mm; /*point back to vma owner */
+  memset(vma->vm_freerg_bin, 0, sizeof(vma->vm_freerg_bin));
+  vma->vm_freerg_binmap = 0;
+  vma->vm_rgtag_start = vma->vm_rgtag_end = NULL;
+  vma->vm_rgtag_shift = 0;
+  vma->vm_nr_freerg = 0;
+  vma->vm_freerg_bytes = 0;
+
+  mm->vma_root = vma_insert(mm->vma_root, vma);
+  if (prev != NULL) {
+    vma->vm_next = prev->vm_next;
+    prev->vm_next = vma;
+  } else {
+    vma->vm_next = mm->mmap;
+    mm->mmap = vma;
+  }
+  mm->vmatbl[vmaid] = vma;
+  mm->map_count++;
+
+  return vma;
+}
+
+/*vma_set_end - move the end of a vm area
+ *@mm: memory region
+ *@vma: vm area
+ *@end: new end
+ *
+ */
+int vma_set_end(struct mm_struct *mm, struct vm_area_struct *vma,
+                unsigned long end) {
+  if (end < vma->vm_start)
+    return -1;
+
+  vma->vm_end = end;
+  vma_fix_path(mm->vma_root, vma);
+  return 0;
+}
+
+/*vma_free_all - release every vm area of an mm
+ *@mm: memory region going away
+ *
+ */
+void vma_free_all(struct mm_struct *mm) {
+  struct vm_area_struct *vma;
+
+  while ((vma = mm->mmap) != NULL) {
+    mm->mmap = vma->vm_next;
+    vmrg_free_all(vma);
+    free(vma);
+  }
+
+  mm->vma_root = NULL;
+  memset(mm->vmatbl, 0, sizeof(mm->vmatbl));
+  mm->map_count = 0;
+}
+
+//#endif
@@ -0,0 +1,275 @@
+//#ifdef MM_PAGING
+/*
+ * PAGING based Memory Management
+ * Virtual memory region allocator mm/mm-vmrg.c
+ *
+ * The free regions of a vm area are kept in segregated lists, one bin
+ * per power of two size class, with a bitmap of the non empty bins. Any
+ * region of a bin at or above the rounded up class of a request fits, so
+ * the allocation is one find-first-set on the bitmap; the bin of the
+ * rounded down class is only scanned when no such bin is populated.
+ *
+ * Both ends of every free region are hashed as boundary tags. A freed
+ * range looks up the free region ending where it starts and the one
+ * starting where it ends and is merged with them, so adjacent free
+ * regions never stay split. The tag table doubles with the free regions.
+ */
+
+#include "mm.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Size class of a region, the log2 of its size rounded down */
+static int vmrg_class(unsigned long size) {
+  if (size > UINT32_MAX)
+    return VM_RG_NR_BINS - 1;
+
+  return 31 - __builtin_clz((uint32_t)size);
+}
+
+static unsigned int vmrg_tag_hash(struct vm_area_struct *vma,
+                                  unsigned long addr) {
+  return (uint32_t)(addr * 2654435761u) >> (32 - vma->vm_rgtag_shift);
+}
+
+static void vmrg_tag_add(struct vm_area_struct *vma, struct vm_rg_struct *rg) {
+  unsigned int hs = vmrg_tag_hash(vma, rg->rg_start);
+  unsigned int he = vmrg_tag_hash(vma, rg->rg_end);
+
+  rg->rg_snext = vma->vm_rgtag_start[hs];
+  vma->vm_rgtag_start[hs] = rg;
+  rg->rg_enext = vma->vm_rgtag_end[he];
+  vma->vm_rgtag_end[he] = rg;
+}
+
+/*
+ *  vmrg_tag_grow - rehash the boundary tags into a larger table
+ *  @vma: vm area
+ *  @shift: log2 of the new table size
+ */
+static void vmrg_tag_grow(struct vm_area_struct *vma, int shift) {
+  struct vm_rg_struct *rg;
+  int k;
+
+  free(vma->vm_rgtag_start);
+  free(vma->vm_rgtag_end);
+  vma->vm_rgtag_start = calloc(1 << shift, sizeof(struct vm_rg_struct *));
+  vma->vm_rgtag_end = calloc(1 << shift, sizeof(struct vm_rg_struct *));
+  vma->vm_rgtag_shift = shift;
+
+  for (k = 0; k < VM_RG_NR_BINS; k++)
+    for (rg = vma->vm_freerg_bin[k]; rg != NULL; rg = rg->rg_next)
+      vmrg_tag_add(vma, rg);
+}
+
+/*
+ *  vmrg_tag_find - find the free region with a boundary at an address
+ *  @vma: vm area
+ *  @addr: boundary address
+ *  @end: match the end of the regions instead of their start
+ */
+static struct vm_rg_struct *vmrg_tag_find(struct vm_area_struct *vma,
+                                          unsigned long addr, int end) {
+  struct vm_rg_struct *rg;
+
+  if (vma->vm_rgtag_shift == 0)
+    return NULL;
+
+  if (end) {
+    for (rg = vma->vm_rgtag_end[vmrg_tag_hash(vma, addr)]; rg != NULL;
+         rg = rg->rg_enext)
+      if (rg->rg_end == addr)
+        return rg;
+  } else {
+    for (rg = vma->vm_rgtag_start[vmrg_tag_hash(vma, addr)]; rg != NULL;
+         rg = rg->rg_snext)
+      if (rg->rg_start == addr)
+        return rg;
+  }
+
+  return NULL;
+}
+
+/*
+ *  vmrg_link - put a free region in its bin and tag both of its ends
+ *  @vma: vm area
+ *  @rg: free region, not adjacent to another free region
+ */
+static void vmrg_link(struct vm_area_struct *vma, struct vm_rg_struct *rg) {
+  int k = vmrg_class(rg->rg_end - rg->rg_start);
+
+  if (vma->vm_rgtag_shift == 0)
+    vmrg_tag_grow(vma, VM_RG_TAG_MIN_SHIFT);
+  else if (vma->vm_nr_freerg >= (1 << vma->vm_rgtag_shift))
+    vmrg_tag_grow(vma, vma->vm_rgtag_shift + 1);
+
+  rg->rg_prev = NULL;
+  rg->rg_next = vma->vm_freerg_bin[k];
+  if (rg->rg_next != NULL)
+    rg->rg_next->rg_prev = rg;
+  vma->vm_freerg_bin[k] = rg;
+  vma->vm_freerg_binmap |= 1u << k;
+
+  vmrg_tag_add(vma, rg);
+  vma->vm_nr_freerg++;
+  vma->vm_freerg_bytes += rg->rg_end - rg->rg_start;
+}
+
+static void vmrg_unlink(struct vm_area_struct *vma, struct vm_rg_struct *rg) {
+  int k = vmrg_class(rg->rg_end - rg->rg_start);
+  struct vm_rg_struct **pp;
+
+  if (rg->rg_prev != NULL)
+    rg->rg_prev->rg_next = rg->rg_next;
+  else
+    vma->vm_freerg_bin[k] = rg->rg_next;
+  if (rg->rg_next != NULL)
+    rg->rg_next->rg_prev = rg->rg_prev;
+  if (vma->vm_freerg_bin[k] == NULL)
+    vma->vm_freerg_binmap &= ~(1u << k);
+
+  pp = &vma->vm_rgtag_start[vmrg_tag_hash(vma, rg->rg_start)];
+  while (*pp != rg)
+    pp = &(*pp)->rg_snext;
+  *pp = rg->rg_snext;
+
+  pp = &vma->vm_rgtag_end[vmrg_tag_hash(vma, rg->rg_end)];
+  while (*pp != rg)
+    pp = &(*pp)->rg_enext;
+  *pp = rg->rg_enext;
+
+  rg->rg_next = rg->rg_prev = NULL;
+  vma->vm_nr_freerg--;
+  vma->vm_freerg_bytes -= rg->rg_end - rg->rg_start;
+}
+
+/*
+ *  vmrg_free - give a range back to the free bins of a vm area
+ *  @vma: vm area
+ *  @start: first byte of the range
+ *  @end: first byte after the range
+ *
+ *  The range is coalesced with the free regions on both sides of it
+ */
+int vmrg_free(struct vm_area_struct *vma, unsigned long start,
+              unsigned long end) {
+  struct vm_rg_struct *rg;
+
+  if (vma == NULL || start >= end)
+    return -1;
+
+  rg = vmrg_tag_find(vma, start, 1);
+  if (rg != NULL) {
+    vmrg_unlink(vma, rg);
+    start = rg->rg_start;
+    free(rg);
+    vma->vm_mm->stat.rg_merge++;
+  }
+
+  rg = vmrg_tag_find(vma, end, 0);
+  if (rg != NULL) {
+    vmrg_unlink(vma, rg);
+    end = rg->rg_end;
+    free(rg);
+    vma->vm_mm->stat.rg_merge++;
+  }
+
+  vmrg_link(vma, init_vm_rg(start, end));
+  return 0;
+}
+
+/*
+ *  vmrg_largest - size of the largest free region of a vm area
+ *  @vma: vm area
+ */
+unsigned long vmrg_largest(struct vm_area_struct *vma) {
+  struct vm_rg_struct *rg;
+  unsigned long largest = 0;
+
+  if (vma == NULL || vma->vm_freerg_binmap == 0)
+    return 0;
+
+  /* Only the highest populated bin can hold it */
+  for (rg = vma->vm_freerg_bin[31 - __builtin_clz(vma->vm_freerg_binmap)];
+       rg != NULL; rg = rg->rg_next)
+    if (rg->rg_end - rg->rg_start > largest)
+      largest = rg->rg_end - rg->rg_start;
+
+  return largest;
+}
+
+/*get_free_vmrg_area - get a free vm region
+ *@caller: caller
+ *@vmaid: ID vm area to alloc memory region
+ *@size: allocated size
+ *@newrg: return the allocated range
+ *
+ */
+int get_free_vmrg_area(struct pcb_t *caller, int vmaid, int size,
+                       struct vm_rg_struct *newrg) {
+  struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
+  struct vm_rg_struct *rgit = NULL;
+  int k, fit;
+
+  if (cur_vma == NULL || size <= 0 || cur_vma->vm_freerg_binmap == 0)
+    return -1;
+
+  /* Every region of the bins from the rounded up class on fits */
+  k = vmrg_class(size);
+  fit = k + ((size & (size - 1)) != 0);
+  if (fit < VM_RG_NR_BINS) {
+    uint32_t bins = cur_vma->vm_freerg_binmap & ~((1u << fit) - 1);
+
+    if (bins != 0)
+      rgit = cur_vma->vm_freerg_bin[__builtin_ctz(bins)];
+  }
+
+  /* Otherwise a region of the rounded down class may still be enough */
+  if (rgit == NULL)
+    for (rgit = cur_vma->vm_freerg_bin[k]; rgit != NULL; rgit = rgit->rg_next)
+      if (rgit->rg_start + size <= rgit->rg_end)
+        break;
+
+  if (rgit == NULL)
+    return -1;
+
+  vmrg_unlink(cur_vma, rgit);
+  newrg->rg_start = rgit->rg_start;
+  newrg->rg_end = rgit->rg_start + size;
+
+  /* The rest of the region goes back to the bin of its new size */
+  if (newrg->rg_end < rgit->rg_end) {
+    rgit->rg_start = newrg->rg_end;
+    vmrg_link(cur_vma, rgit);
+  } else {
+    free(rgit);
+  }
+
+  return 0;
+}
+
+/*
+ *  vmrg_free_all - drop every free region of a vm area
+ *  @vma: vm area going away
+ */
+void vmrg_free_all(struct vm_area_struct *vma) {
+  struct vm_rg_struct *rg;
+  int k;
+
+  for (k = 0; k < VM_RG_NR_BINS; k++) {
+    while ((rg = vma->vm_freerg_bin[k]) != NULL) {
+      vma->vm_freerg_bin[k] = rg->rg_next;
+      free(rg);
+    }
+  }
+  free(vma->vm_rgtag_start);
+  free(vma->vm_rgtag_end);
+  vma->vm_rgtag_start = vma->vm_rgtag_end = NULL;
+  vma->vm_rgtag_shift = 0;
+  vma->vm_freerg_binmap = 0;
+  vma->vm_nr_freerg = 0;
+  vma->vm_freerg_bytes = 0;
+}
+
+//#endif
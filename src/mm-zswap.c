@@ -0,0 +1,345 @@
+// #ifdef MM_ZSWAP
+/*
+ * PAGING based Memory Management
+ * Compressed swap cache mm/mm-zswap.c
+ *
+ * zswap sits between MEMRAM and a MEMSWP device: an evicted page is
+ * compressed into a bounded pool in RAM, keyed by its MEMSWP frame, and
+ * only written to the device when the pool overflows (oldest entry
+ * first). Same-filled pages (mostly zero pages) are kept as one byte.
+ * The pool has its own lock, taken last after the mm and frame locks.
+ */
+
+#include "mm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef MM_ZSWAP
+
+/* Compressed stream: a control byte c < ZSWAP_RUN_FLAG is followed by
+ * c + 1 literal bytes, c >= ZSWAP_RUN_FLAG by one byte repeated
+ * c - ZSWAP_RUN_FLAG + ZSWAP_RUN_MIN times */
+#define ZSWAP_RUN_FLAG 128
+#define ZSWAP_RUN_MIN 3
+#define ZSWAP_RUN_MAX (255 - ZSWAP_RUN_FLAG + ZSWAP_RUN_MIN)
+#define ZSWAP_LIT_MAX ZSWAP_RUN_FLAG
+
+/*
+ *  zswap_compress - run length encode a page
+ *  @src: page content
+ *  @len: page size
+ *  @dst: output buffer, at least @len bytes
+ *
+ *  Return the compressed length, or -1 if it does not fit in @len
+ */
+static int zswap_compress(const BYTE *src, int len, BYTE *dst) {
+  int i = 0, out = 0;
+  int litstart = -1;
+
+  while (i < len) {
+    int run = 1;
+
+    while (i + run < len && run < ZSWAP_RUN_MAX && src[i + run] == src[i])
+      run++;
+
+    if (run >= ZSWAP_RUN_MIN) {
+      litstart = -1;
+      if (out + 2 > len)
+        return -1;
+      dst[out++] = (BYTE)(ZSWAP_RUN_FLAG + run - ZSWAP_RUN_MIN);
+      dst[out++] = src[i];
+      i += run;
+      continue;
+    }
+
+    /* Append to the open literal run or start a new one */
+    if (litstart < 0 || (unsigned char)dst[litstart] + 1 == ZSWAP_LIT_MAX) {
+      if (out + 2 > len)
+        return -1;
+      litstart = out;
+      dst[out++] = 0;
+    } else {
+      if (out + 1 > len)
+        return -1;
+      dst[litstart]++;
+    }
+    dst[out++] = src[i++];
+  }
+
+  return out;
+}
+
+/*
+ *  zswap_decompress - decode a page produced by zswap_compress
+ *  @src: compressed stream
+ *  @srclen: compressed length
+ *  @dst: page buffer
+ *  @len: page size
+ */
+static int zswap_decompress(const BYTE *src, int srclen, BYTE *dst,
+                            int len) {
+  int i = 0, out = 0;
+
+  while (i < srclen && out < len) {
+    int c = (unsigned char)src[i++];
+
+    if (c >= ZSWAP_RUN_FLAG) {
+      int run = c - ZSWAP_RUN_FLAG + ZSWAP_RUN_MIN;
+
+      memset(&dst[out], src[i++], run);
+      out += run;
+    } else {
+      memcpy(&dst[out], &src[i], c + 1);
+      out += c + 1;
+      i += c + 1;
+    }
+  }
+
+  return (out == len) ? 0 : -1;
+}
+
+static void zswap_lru_del(struct zswap_struct *zs,
+                          struct zswap_entry_struct *ze) {
+  if (ze->lru_prev != NULL)
+    ze->lru_prev->lru_next = ze->lru_next;
+  else
+    zs->lru_head = ze->lru_next;
+
+  if (ze->lru_next != NULL)
+    ze->lru_next->lru_prev = ze->lru_prev;
+  else
+    zs->lru_tail = ze->lru_prev;
+}
+
+static void zswap_lru_add(struct zswap_struct *zs,
+                          struct zswap_entry_struct *ze) {
+  ze->lru_prev = NULL;
+  ze->lru_next = zs->lru_head;
+  if (zs->lru_head != NULL)
+    zs->lru_head->lru_prev = ze;
+  zs->lru_head = ze;
+  if (zs->lru_tail == NULL)
+    zs->lru_tail = ze;
+}
+
+static void zswap_entry_free(struct zswap_struct *zs,
+                             struct zswap_entry_struct *ze) {
+  zswap_lru_del(zs, ze);
+  zs->tree[ze->swpfpn] = NULL;
+  zs->pool_used -= ze->len;
+  zs->nr_stored--;
+  free(ze->data);
+  free(ze);
+}
+
+/*
+ *  zswap_writeback - push the oldest entry out to the MEMSWP device
+ *  @zs: zswap pool, locked by the caller
+ *
+ *  The page is decompressed into zs->page, zs->buf is left alone
+ */
+static int zswap_writeback(struct zswap_struct *zs) {
+  struct zswap_entry_struct *ze = zs->lru_tail;
+  BYTE *page = zs->page;
+  int cellidx;
+
+  if (ze == NULL)
+    return -1;
+
+  if (ze->same_filled)
+    memset(page, ze->data[0], PAGING_PAGESZ);
+  else
+    zswap_decompress(ze->data, ze->len, page, PAGING_PAGESZ);
+
+  for (cellidx = 0; cellidx < PAGING_PAGESZ; cellidx++)
+    MEMPHY_write(zs->mswp, PAGING_PHYADDR(ze->swpfpn, cellidx), page[cellidx]);
+
+  zs->nr_writeback++;
+  zswap_entry_free(zs, ze);
+
+  return 0;
+}
+
+/*
+ *  zswap_store - compress a MEMRAM frame into the pool
+ *  @zs: zswap pool
+ *  @mram: MEMRAM holding the page
+ *  @fpn: source frame
+ *  @swpfpn: MEMSWP frame the page is swapped to
+ *
+ *  Return 0 if the page is cached, -1 if it has to go to the device
+ */
+int zswap_store(struct zswap_struct *zs, struct memphy_struct *mram, int fpn,
+                int swpfpn) {
+  struct zswap_entry_struct *ze;
+  BYTE *page, *buf;
+  int cellidx, len, same_filled = 1;
+
+  if (zs == NULL || swpfpn < 0 || swpfpn >= zs->maxfp)
+    return -1;
+
+  /* The scratch buffers belong to the pool, a page can reach 1MB */
+  pthread_mutex_lock(&zs->lock);
+  page = zs->page;
+  buf = zs->buf;
+  for (cellidx = 0; cellidx < PAGING_PAGESZ; cellidx++) {
+    MEMPHY_read(mram, PAGING_PHYADDR(fpn, cellidx), &page[cellidx]);
+    if (page[cellidx] != page[0])
+      same_filled = 0;
+  }
+
+  if (same_filled) {
+    buf[0] = page[0];
+    len = 1;
+  } else {
+    len = zswap_compress(page, PAGING_PAGESZ, buf);
+  }
+
+  /* Old content of the slot is superseded either way */
+  if (zs->tree[swpfpn] != NULL)
+    zswap_entry_free(zs, zs->tree[swpfpn]);
+
+  if (len < 0 || len > zs->pool_sz) {
+    zs->nr_reject++;
+    pthread_mutex_unlock(&zs->lock);
+    return -1;
+  }
+
+  /* Make room by writing the oldest entries back to the device, this
+   * reuses zs->page but not the compressed page in zs->buf */
+  while (zs->pool_used + len > zs->pool_sz)
+    zswap_writeback(zs);
+
+  ze = malloc(sizeof(struct zswap_entry_struct));
+  ze->swpfpn = swpfpn;
+  ze->len = len;
+  ze->same_filled = same_filled;
+  ze->data = malloc(len);
+  memcpy(ze->data, buf, len);
+
+  zs->tree[swpfpn] = ze;
+  zswap_lru_add(zs, ze);
+  zs->pool_used += len;
+  zs->nr_stored++;
+  zs->nr_store++;
+  if (same_filled)
+    zs->nr_same_filled++;
+  pthread_mutex_unlock(&zs->lock);
+
+  return 0;
+}
+
+/*
+ *  zswap_load - decompress a cached page into a MEMRAM frame
+ *  @zs: zswap pool
+ *  @swpfpn: MEMSWP frame of the page
+ *  @mram: MEMRAM
+ *  @fpn: destination frame
+ *
+ *  The entry stays cached so a clean page keeps a valid swap copy.
+ *  Return 0 on hit, -1 if the page must be read from the device
+ */
+int zswap_load(struct zswap_struct *zs, int swpfpn, struct memphy_struct *mram,
+               int fpn) {
+  struct zswap_entry_struct *ze;
+  BYTE *page;
+  int cellidx;
+
+  if (zs == NULL || swpfpn < 0 || swpfpn >= zs->maxfp)
+    return -1;
+
+  pthread_mutex_lock(&zs->lock);
+  page = zs->page;
+  ze = zs->tree[swpfpn];
+  if (ze == NULL) {
+    pthread_mutex_unlock(&zs->lock);
+    return -1;
+  }
+
+  if (ze->same_filled)
+    memset(page, ze->data[0], PAGING_PAGESZ);
+  else if (zswap_decompress(ze->data, ze->len, page, PAGING_PAGESZ) < 0) {
+    pthread_mutex_unlock(&zs->lock);
+    return -1;
+  }
+
+  /* Recently used, keep it away from writeback */
+  zswap_lru_del(zs, ze);
+  zswap_lru_add(zs, ze);
+  zs->nr_load++;
+
+  /* Copied out before the scratch page is released with the lock */
+  for (cellidx = 0; cellidx < PAGING_PAGESZ; cellidx++)
+    MEMPHY_write(mram, PAGING_PHYADDR(fpn, cellidx), page[cellidx]);
+  pthread_mutex_unlock(&zs->lock);
+
+  return 0;
+}
+
+/*
+ *  zswap_invalidate - drop the cached copy of a MEMSWP frame
+ *  @zs: zswap pool
+ *  @swpfpn: MEMSWP frame
+ */
+int zswap_invalidate(struct zswap_struct *zs, int swpfpn) {
+  if (zs == NULL || swpfpn < 0 || swpfpn >= zs->maxfp)
+    return -1;
+
+  pthread_mutex_lock(&zs->lock);
+  if (zs->tree[swpfpn] == NULL) {
+    pthread_mutex_unlock(&zs->lock);
+    return -1;
+  }
+
+  zswap_entry_free(zs, zs->tree[swpfpn]);
+  pthread_mutex_unlock(&zs->lock);
+  return 0;
+}
+
+/*
+ *  init_zswap - attach a compressed cache to a MEMSWP device
+ *  @mswp: swap device
+ *  @pool_sz: pool budget in bytes
+ */
+int init_zswap(struct memphy_struct *mswp, long pool_sz) {
+  struct zswap_struct *zs;
+
+  if (mswp == NULL || mswp->maxfp <= 0 || pool_sz <= 0)
+    return -1;
+
+  zs = malloc(sizeof(struct zswap_struct));
+  zs->mswp = mswp;
+  zs->maxfp = mswp->maxfp;
+  zs->tree = calloc(zs->maxfp, sizeof(struct zswap_entry_struct *));
+  zs->lru_head = zs->lru_tail = NULL;
+  zs->pool_sz = pool_sz;
+  zs->pool_used = 0;
+  zs->nr_stored = 0;
+  pthread_mutex_init(&zs->lock, NULL);
+  zs->page = malloc(PAGING_PAGESZ);
+  zs->buf = malloc(PAGING_PAGESZ);
+  zs->nr_store = 0;
+  zs->nr_same_filled = 0;
+  zs->nr_reject = 0;
+  zs->nr_load = 0;
+  zs->nr_writeback = 0;
+
+  mswp->zswap = zs;
+  return 0;
+}
+
+int print_zswap_stat(struct zswap_struct *zs) {
+  if (zs == NULL)
+    return -1;
+
+  printf("zswap_stat: stored %lu pages (same-filled %lu), rejected %lu, "
+         "loaded %lu, written back %lu, pool %ld/%ld bytes in %d entries\n",
+         zs->nr_store, zs->nr_same_filled, zs->nr_reject, zs->nr_load,
+         zs->nr_writeback, zs->pool_used, zs->pool_sz, zs->nr_stored);
+  return 0;
+}
+
+#endif
+
+// #endif
@@ -7,11 +7,51 @@
 #include "mm.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+
+#define PAGING_GEOM(pagesz, shift, bus)                                        \
+  {(pagesz),                                                                   \
+   (shift),                                                                    \
+   (bus),                                                                      \
+   GENMASK((shift) - 1, 0),                                                    \
+   GENMASK((bus) - 1, (shift)),                                                \
+   1 << ((bus) - (shift)),                                                     \
+   DIV_ROUND_UP((bus) - (shift), PAGING_PT_BITS) < 2                           \
+       ? 2                                                                     \
+       : DIV_ROUND_UP((bus) - (shift), PAGING_PT_BITS)}
+
+struct paging_geom_struct paging_geom =
+    PAGING_GEOM(PAGING_DEFAULT_PAGESZ, NBITS(PAGING_DEFAULT_PAGESZ),
+                PAGING_DEFAULT_BUS_WIDTH);
+
+/*
+ * paging_geom_init - set the page size and CPU bus width
+ * @pagesz    : page size, a power of two
+ * @bus_width : virtual address bits
+ *
+ * Must run before any MEMPHY or mm is set up
+ */
+int paging_geom_init(int pagesz, int bus_width) {
+  int shift;
+
+  if (pagesz < PAGING_MIN_PAGESZ || pagesz > PAGING_MAX_PAGESZ ||
+      (pagesz & (pagesz - 1)) != 0)
+    return -1;
+
+  shift = NBITS(pagesz);
+  if (bus_width <= shift || bus_width > PAGING_MAX_BUS_WIDTH)
+    return -1;
+
+  paging_geom =
+      (struct paging_geom_struct)PAGING_GEOM(pagesz, shift, bus_width);
+  return 0;
+}
+
 /*
  * init_pte - Initialize PTE entry
  */
-int init_pte(uint32_t *pte,
+int init_pte(pte_t *pte,
              int pre,    // present
              int fpn,    // FPN
              int drt,    // dirty
@@ -45,11 +85,14 @@ int init_pte(uint32_t *pte,
 
 /*
  * pte_set_swap - Set PTE entry for swapped page
- * @pte    : target page table entry (PTE)
+ * @mm     : address space of the page
+ * @pgn    : page number
  * @swptyp : swap type
  * @swpoff : swap offset
  */
-int pte_set_swap(uint32_t *pte, int swptyp, int swpoff) {
+int pte_set_swap(struct mm_struct *mm, int pgn, int swptyp, int swpoff) {
+  pte_t *pte = pte_alloc(mm, pgn, 0);
+
   SETBIT(*pte, PAGING_PTE_PRESENT_MASK);
   SETBIT(*pte, PAGING_PTE_SWAPPED_MASK);
 
@@ -60,13 +103,18 @@ int pte_set_swap(uint32_t *pte, int swptyp, int swpoff) {
 }
 
 /*
- * pte_set_swap - Set PTE entry for on-line page
- * @pte   : target page table entry (PTE)
+ * pte_set_fpn - Set PTE entry for on-line page
+ * @mm    : address space of the page
+ * @pgn   : page number
  * @fpn   : frame page number (FPN)
  */
-int pte_set_fpn(uint32_t *pte, int fpn) {
+int pte_set_fpn(struct mm_struct *mm, int pgn, int fpn) {
+  pte_t *pte = pte_alloc(mm, pgn, 1);
+
   SETBIT(*pte, PAGING_PTE_PRESENT_MASK);
   CLRBIT(*pte, PAGING_PTE_SWAPPED_MASK);
+  CLRBIT(*pte, PAGING_PTE_DIRTY_MASK);
+  CLRBIT(*pte, PAGING_PTE_SWPOFF_MASK); /* drop stale swap offset bits */
 
   SETVAL(*pte, fpn, PAGING_PTE_FPN_MASK, PAGING_PTE_FPN_LOBIT);
 
@@ -109,10 +157,13 @@ int vmap_page_range(
       break;
     }
     int frame_number = frame_iterator->fpn;
-    uint32_t *page_table_entry = &process->mm->pgd[page_number + page_index];
-    pte_set_fpn(page_table_entry, frame_number);
+    pte_set_fpn(process->mm, page_number + page_index, frame_number);
     frame_iterator = frame_iterator->fp_next;
 
+    /* Reverse mapping of the frame back to its page */
+    MEMPHY_set_rmap(process->mram, frame_number, process->mm,
+                    page_number + page_index);
+
     /* Tracking for later page replacement activities (if needed)
      * Enqueue new usage page */
     enlist_pgn_node(&process->mm->fifo_pgn, page_number + page_index);
@@ -123,6 +174,36 @@ int vmap_page_range(
   return return_value;
 }
 
+#ifdef MM_ZERO_PAGE
+/*
+ * vmap_zero_page_range - map a range of page on the shared zero frame
+ * @process       : process call
+ * @start_address : start address which is aligned to pagesz
+ * @num_pages     : num of mapping pages
+ * @mapped_region : return mapped region
+ *
+ * Pages are read-only (COW), the first store gets them a private frame
+ */
+int vmap_zero_page_range(struct pcb_t *process, int start_address,
+                         int num_pages, struct vm_rg_struct *mapped_region) {
+  int page_number = PAGING_PGN(start_address);
+  int page_index;
+
+  for (page_index = 0; page_index < num_pages; page_index++) {
+    pte_set_fpn(process->mm, page_number + page_index,
+                process->mram->zero_fpn);
+    SETBIT(*pte_lookup(process->mm, page_number + page_index),
+           PAGING_PTE_COW_MASK);
+  }
+  process->mm->stat.zeromap += num_pages;
+
+  mapped_region->rg_start = start_address;
+  mapped_region->rg_end = start_address + num_pages * PAGING_PAGESZ;
+
+  return 0;
+}
+#endif
+
 /*
  * alloc_pages_range - allocate req_pgnum of frame in ram
  * @caller    : caller
@@ -137,39 +218,25 @@ int alloc_pages_range(struct pcb_t *caller, int req_pgnum,
   struct framephy_struct *newfp_str = NULL;
 
   for (pgit = 0; pgit < req_pgnum; pgit++) {
-    if (MEMPHY_get_freefp(caller->mram, &fpn) == 0) {
-      struct framephy_struct *newfp = malloc(sizeof(struct framephy_struct));
-      newfp->fpn = fpn;
-      newfp->owner = caller->mm;
-      newfp->fp_next = newfp_str;
-      newfp_str = newfp;
-    } else { // ERROR CODE of obtaining somes but not enough frames
+    if (alloc_frame(caller, &fpn) < 0) {
+      // ERROR CODE of obtaining somes but not enough frames
       // MEMPHY_put_freefp to take back free frames
       // delete all framephy_struct in newfp_list
-      int vicpgn, swpfpn;
-      if (find_victim_page(caller->mm, &vicpgn) == -1 ||
-          MEMPHY_get_freefp(caller->active_mswp, &swpfpn) == -1) {
-        while (newfp_str != NULL) {
-          MEMPHY_put_freefp(caller->mram, newfp_str->fpn);
-          struct framephy_struct *remain_fp_str = newfp_str->fp_next;
-          free(newfp_str);
-          newfp_str = remain_fp_str;
-        }
-        return -1;
+      while (newfp_str != NULL) {
+        MEMPHY_put_freefp(caller->mram, newfp_str->fpn);
+        struct framephy_struct *remain_fp_str = newfp_str->fp_next;
+        free(newfp_str);
+        newfp_str = remain_fp_str;
       }
-      // swap to get free frame
-      uint32_t vicpte = caller->mm->pgd[vicpgn];
-      int vicfpn = PAGING_FPN(vicpte);
-      __swap_cp_page(caller->mram, vicfpn, caller->active_mswp, swpfpn);
-      pte_set_swap(&caller->mm->pgd[vicpgn], 0, swpfpn);
-
-      // set up new free frame
-      struct framephy_struct *newfp = malloc(sizeof(struct framephy_struct));
-      newfp->fpn = vicfpn;
-      newfp->owner = caller->mm;
-      newfp->fp_next = newfp_str;
-      newfp_str = newfp;
+      return -1;
     }
+
+    // set up new free frame
+    struct framephy_struct *newfp = malloc(sizeof(struct framephy_struct));
+    newfp->fpn = fpn;
+    newfp->owner = caller->mm;
+    newfp->fp_next = newfp_str;
+    newfp_str = newfp;
   }
 
   // get result
@@ -178,16 +245,14 @@ int alloc_pages_range(struct pcb_t *caller, int req_pgnum,
 }
 
 /*
- * vm_map_ram - do the mapping all vm are to ram storage device
- * @caller    : caller
- * @astart    : vm area start
- * @aend      : vm area end
+ * vm_map_pages - map a range of pages one by one
+ * @caller    : caller, its mm lock is held
  * @mapstart  : start mapping point
  * @incpgnum  : number of mapped page
  * @ret_rg    : returned region
  */
-int vm_map_ram(struct pcb_t *caller, int astart, int aend, int mapstart,
-               int incpgnum, struct vm_rg_struct *ret_rg) {
+int vm_map_pages(struct pcb_t *caller, int mapstart, int incpgnum,
+                 struct vm_rg_struct *ret_rg) {
   struct framephy_struct *frm_lst = NULL;
   int ret_alloc;
 
@@ -198,6 +263,13 @@ int vm_map_ram(struct pcb_t *caller, int astart, int aend, int mapstart,
    *in endless procedure of swap-off to get frame and we have not provide
    *duplicate control mechanism, keep it simple
    */
+#ifdef MM_ZERO_PAGE
+  if (caller->mram->zero_fpn >= 0) {
+    /* Back the range by the shared zero frame, frames come on first store */
+    vmap_zero_page_range(caller, mapstart, incpgnum, ret_rg);
+    return 0;
+  }
+#endif
   ret_alloc = alloc_pages_range(caller, incpgnum, &frm_lst);
 
   if (ret_alloc < 0 && ret_alloc != -3000)
@@ -215,9 +287,41 @@ int vm_map_ram(struct pcb_t *caller, int astart, int aend, int mapstart,
    * do the swaping all to swapper to get the all in ram */
   vmap_page_range(caller, mapstart, incpgnum, frm_lst, ret_rg);
 
+  /* The frames are tracked by their PTEs now, drop the list */
+  while (frm_lst != NULL) {
+    struct framephy_struct *fp = frm_lst->fp_next;
+
+    free(frm_lst);
+    frm_lst = fp;
+  }
+
   return 0;
 }
 
+/*
+ * vm_map_ram - do the mapping all vm are to ram storage device
+ * @caller    : caller
+ * @astart    : vm area start
+ * @aend      : vm area end
+ * @mapstart  : start mapping point
+ * @incpgnum  : number of mapped page
+ * @ret_rg    : returned region
+ */
+int vm_map_ram(struct pcb_t *caller, int astart, int aend, int mapstart,
+               int incpgnum, struct vm_rg_struct *ret_rg) {
+  int ret;
+
+  pthread_mutex_lock(MM_LOCKP(caller->mm));
+#ifdef MM_HUGEPAGE
+  ret = vmap_hpage_range(caller, mapstart, incpgnum, ret_rg);
+#else
+  ret = vm_map_pages(caller, mapstart, incpgnum, ret_rg);
+#endif
+  pthread_mutex_unlock(MM_LOCKP(caller->mm));
+
+  return ret;
+}
+
 /* Swap copy content page from source frame to destination frame
  * @mpsrc  : source memphy
  * @srcfpn : source physical page number (FPN)
@@ -227,10 +331,10 @@ int vm_map_ram(struct pcb_t *caller, int astart, int aend, int mapstart,
 int __swap_cp_page(struct memphy_struct *mpsrc, int srcfpn,
                    struct memphy_struct *mpdst, int dstfpn) {
   int cellidx;
-  int addrsrc, addrdst;
+  paddr_t addrsrc, addrdst;
   for (cellidx = 0; cellidx < PAGING_PAGESZ; cellidx++) {
-    addrsrc = srcfpn * PAGING_PAGESZ + cellidx;
-    addrdst = dstfpn * PAGING_PAGESZ + cellidx;
+    addrsrc = PAGING_PHYADDR(srcfpn, cellidx);
+    addrdst = PAGING_PHYADDR(dstfpn, cellidx);
 
     BYTE data;
     MEMPHY_read(mpsrc, addrsrc, &data);
@@ -246,22 +350,89 @@ int __swap_cp_page(struct memphy_struct *mpsrc, int srcfpn,
  * @caller: mm owner
  */
 int init_mm(struct mm_struct *mm, struct pcb_t *caller) {
-  struct vm_area_struct *vma = malloc(sizeof(struct vm_area_struct));
+  pt_init(mm);
+  init_symtbl(mm);
+
+  mm->fifo_pgn = NULL;
+  mm->stat.swpin = 0;
+  mm->stat.swpout = 0;
+  mm->stat.swpclean = 0;
+  mm->stat.reclaim = 0;
+  mm->stat.ra_issued = 0;
+  mm->stat.ra_hit = 0;
+  mm->stat.ra_waste = 0;
+  mm->stat.zeromap = 0;
+  mm->stat.cow = 0;
+  mm->stat.fault = 0;
+  mm->stat.thp_map = 0;
+  mm->stat.thp_promote = 0;
+  mm->stat.thp_demote = 0;
+  mm->stat.rg_alloc = 0;
+  mm->stat.rg_reuse = 0;
+  mm->stat.rg_free = 0;
+  mm->stat.rg_merge = 0;
+  mm->stat.xlc_hit = 0;
+  mm->stat.xlc_miss = 0;
+  mm->nr_hpage = 0;
+#ifdef MM_XLATE_CACHE
+  for (int i = 0; i < MM_XLATE_CACHE; i++)
+    caller->xlc[i].rgid = -1;
+  caller->xlc_next = 0;
+  mm->xlc = caller->xlc;
+#endif
+#ifdef MM_SWAP_READAHEAD
+  mm->ra_win = MM_SWAP_READAHEAD;
+#else
+  mm->ra_win = 0;
+#endif
+  mm->asid = 0; /* generation 0 is never current, assigned on first use */
+  mm->tlb_mask = 0;
+  pthread_mutex_init(&mm->lock, NULL);
+
+  /* By default the owner comes with at least one vma, the heap */
+  mm->mmap = mm->vma_root = NULL;
+  memset(mm->vmatbl, 0, sizeof(mm->vmatbl));
+  mm->map_count = 0;
+  vma_create(mm, 0, 0, VM_AREA_HEAP);
+
+  return 0;
+}
+
+/*
+ * exit_mm - tear down the Memory Management instance of a finished process
+ * @caller: mm owner
+ *
+ * Frames and swap slots go back to their MEMPHY pools in one walk of the
+ * page table, then every structure of the mm is freed along with it
+ */
+int exit_mm(struct pcb_t *caller) {
+  struct mm_struct *mm = caller->mm;
 
-  mm->pgd = malloc(PAGING_MAX_PGN * sizeof(uint32_t));
+  if (mm == NULL)
+    return -1;
 
-  /* By default the owner comes with at least one vma */
-  vma->vm_id = 1;
-  vma->vm_start = 0;
-  vma->vm_end = vma->vm_start;
-  vma->sbrk = vma->vm_start;
-  struct vm_rg_struct *first_rg = init_vm_rg(vma->vm_start, vma->vm_end);
-  enlist_vm_rg_node(&vma->vm_freerg_list, first_rg);
+  pthread_mutex_lock(MM_LOCKP(mm));
+#ifdef CPU_TLB
+  /* No TLB may keep a translation to a frame being handed out again */
+  tlb_shootdown(mm, 0, PAGING_MAX_PGN);
+#endif
+  free_pcb_memph(caller);
+  pt_free(mm);
+  while (mm->fifo_pgn != NULL) {
+    struct pgn_t *pg = mm->fifo_pgn;
 
-  vma->vm_next = NULL;
-  vma->vm_mm = mm; /*point back to vma owner */
+    mm->fifo_pgn = pg->pg_next;
+    free(pg);
+  }
+  mm->nr_hpage = 0;
+  pthread_mutex_unlock(MM_LOCKP(mm));
 
-  mm->mmap = vma;
+  /* kswapd and ksmd no longer find the mm, nothing else refers to it */
+  vma_free_all(mm);
+  free_symtbl(mm);
+  pthread_mutex_destroy(&mm->lock);
+  free(mm);
+  caller->mm = NULL;
 
   return 0;
 }
@@ -272,6 +443,8 @@ struct vm_rg_struct *init_vm_rg(int rg_start, int rg_end) {
   rgnode->rg_start = rg_start;
   rgnode->rg_end = rg_end;
   rgnode->rg_next = NULL;
+  rgnode->rg_prev = NULL;
+  rgnode->rg_snext = rgnode->rg_enext = NULL;
 
   return rgnode;
 }
@@ -294,6 +467,27 @@ int enlist_pgn_node(struct pgn_t **plist, int pgn) {
   return 0;
 }
 
+int delist_pgn_node(struct pgn_t **plist, int pgn) {
+  struct pgn_t *pnode = *plist;
+  struct pgn_t *pprev = NULL;
+
+  while (pnode != NULL && pnode->pgn != pgn) {
+    pprev = pnode;
+    pnode = pnode->pg_next;
+  }
+
+  if (pnode == NULL)
+    return -1;
+
+  if (pprev == NULL)
+    *plist = pnode->pg_next;
+  else
+    pprev->pg_next = pnode->pg_next;
+  free(pnode);
+
+  return 0;
+}
+
 int print_list_fp(struct framephy_struct *ifp) {
   struct framephy_struct *fp = ifp;
 
@@ -360,10 +554,21 @@ int print_list_pgn(struct pgn_t *ip) {
   return 0;
 }
 
+static int print_pte(struct mm_struct *mm, int pgn, pte_t *pte, void *arg) {
+  printf("%08ld: %016llx\n", pgn * sizeof(pte_t), (unsigned long long)*pte);
+  return 0;
+}
+
 int print_pgtbl(struct pcb_t *caller, uint32_t start, uint32_t end) {
   int pgn_start, pgn_end;
-  int pgit;
 
+  if (caller == NULL || caller->mm == NULL) {
+    printf("print_pgtbl: NULL caller\n");
+    return -1;
+  }
+
+  /* kswapd and ksmd rewrite PTEs and faults link new leaves meanwhile */
+  pthread_mutex_lock(MM_LOCKP(caller->mm));
   if (end == -1) {
     pgn_start = 0;
     struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, 0);
@@ -372,17 +577,70 @@ int print_pgtbl(struct pcb_t *caller, uint32_t start, uint32_t end) {
   pgn_start = PAGING_PGN(start);
   pgn_end = PAGING_PGN(end);
 
-  printf("print_pgtbl: %d - %d", start, end);
-  if (caller == NULL) {
-    printf("NULL caller\n");
+  printf("print_pgtbl: %d - %d\n", start, end);
+  pt_walk(caller->mm, pgn_start, pgn_end, print_pte, NULL);
+  pthread_mutex_unlock(MM_LOCKP(caller->mm));
+
+  return 0;
+}
+
+int print_mm_stat(struct pcb_t *caller) {
+  struct mm_stat_struct *st;
+  struct vm_area_struct *vma;
+  unsigned long free_bytes = 0, largest = 0;
+  int nr_free = 0;
+
+  if (caller == NULL || caller->mm == NULL) {
+    printf("print_mm_stat: NULL caller\n");
     return -1;
   }
-  printf("\n");
-
-  for (pgit = pgn_start; pgit < pgn_end; pgit++) {
-    printf("%08ld: %08x\n", pgit * sizeof(uint32_t), caller->mm->pgd[pgit]);
+  st = &caller->mm->stat;
+
+  /* kswapd and ksmd may still update the counters until exit_mm */
+  pthread_mutex_lock(MM_LOCKP(caller->mm));
+  printf("mm_stat PID=%d: swap-in %lu, swap-out %lu pages (%lu bytes), "
+         "clean drop %lu, direct reclaim %lu, faults %lu\n",
+         caller->pid, st->swpin, st->swpout, st->swpout * PAGING_PAGESZ,
+         st->swpclean, st->reclaim, st->fault);
+  printf("mm_stat PID=%d: page table %lu bytes (%d dirs, %d leaves), "
+         "walk cache hit %lu, miss %lu\n",
+         caller->pid, pt_mem_size(caller->mm), caller->mm->pt_nr_dirs,
+         caller->mm->pt_nr_leaves, st->pwc_hit, st->pwc_miss);
+
+  /* External fragmentation: free bytes out of reach of the largest region */
+  for (vma = caller->mm->mmap; vma != NULL; vma = vma->vm_next) {
+    nr_free += vma->vm_nr_freerg;
+    free_bytes += vma->vm_freerg_bytes;
+    if (vmrg_largest(vma) > largest)
+      largest = vmrg_largest(vma);
   }
-  
+  printf("mm_stat PID=%d: regions allocated %lu (%lu from free bins), "
+         "freed %lu, coalesced %lu, free %d regions %lu bytes, largest %lu, "
+         "fragmentation %lu%%\n",
+         caller->pid, st->rg_alloc, st->rg_reuse, st->rg_free, st->rg_merge,
+         nr_free, free_bytes, largest,
+         free_bytes ? 100 - largest * 100 / free_bytes : 0);
+#ifdef MM_XLATE_CACHE
+  printf("mm_stat PID=%d: translation cache hit %lu, miss %lu\n",
+         caller->pid, st->xlc_hit, st->xlc_miss);
+#endif
+#ifdef MM_ZERO_PAGE
+  printf("mm_stat PID=%d: zero-page mapped %lu pages, cow break %lu\n",
+         caller->pid, st->zeromap, st->cow);
+#endif
+#ifdef MM_HUGEPAGE
+  printf("mm_stat PID=%d: huge pages mapped %lu, promoted %lu, demoted %lu, "
+         "%d in use\n",
+         caller->pid, st->thp_map, st->thp_promote, st->thp_demote,
+         caller->mm->nr_hpage);
+#endif
+#ifdef MM_SWAP_READAHEAD
+  printf("mm_stat PID=%d: readahead %lu pages, hit %lu, waste %lu, "
+         "window %d\n",
+         caller->pid, st->ra_issued, st->ra_hit, st->ra_waste,
+         caller->mm->ra_win);
+#endif
+  pthread_mutex_unlock(MM_LOCKP(caller->mm));
   return 0;
 }
 
@@ -17,15 +17,18 @@ static int done = 0;
 
 #ifdef CPU_TLB
 static int tlbsz;
+static int tlb_l1sz = CPUTLB_L1_ENTRIES;
+static int tlb_ways = CPUTLB_WAYS;
 #endif
 
 #ifdef MM_PAGING
-static int memramsz;
-static int memswpsz[PAGING_MAX_MMSWP];
+static unsigned long memramsz;
+static unsigned long memswpsz[PAGING_MAX_MMSWP];
+static int pagesz = PAGING_DEFAULT_PAGESZ;
+static int bus_width = PAGING_DEFAULT_BUS_WIDTH;
 
 struct mmpaging_ld_args {
   /* A dispatched argument struct to compact many-fields passing to loader */
-  struct memphy_struct *tlb;
   struct memphy_struct *mram;
   struct memphy_struct **mswp;
   struct memphy_struct *active_mswp;
@@ -45,21 +48,38 @@ int num_processes;
 struct cpu_args {
   struct timer_id_t *timer_id;
   int id;
+#ifdef CPU_TLB
+  struct tlb_struct *tlb; /* private TLB of this CPU */
+#endif
 };
 
+/* Give back everything a finished process holds */
+static void free_proc(struct pcb_t *proc) {
+#ifdef MM_PAGING
+  exit_mm(proc);
+#endif
+  free(proc->code->text);
+  free(proc->code);
+  free(proc->page_table);
+  free(proc);
+}
+
 static void *cpu_routine(void *args) {
   struct timer_id_t *timer_id = ((struct cpu_args *)args)->timer_id;
   int id = ((struct cpu_args *)args)->id;
   /* Check for new process in ready queue */
   int time_left = 0;
   struct pcb_t *proc = NULL;
+#ifdef CPU_CYCLE_MODEL
+  unsigned long cpu_cycles = 0;
+#endif
   while (1) {
     /* Check the status of current process */
     if (proc == NULL) {
       /* No process is running, the we load new process from
        * ready queue */
       proc = get_proc();
-      if (proc == NULL) {
+      if (proc == NULL && !done) {
         next_slot(timer_id);
         continue; /* First load failed. skip dummy load */
       }
@@ -67,7 +87,14 @@ static void *cpu_routine(void *args) {
       /* The porcess has finish it job */
       // usleep(100);
       printf("\tCPU %d: Processed %2d has finished\n", id, proc->pid);
-      free(proc);
+#ifdef CPU_CYCLE_MODEL
+      printf("\tCPU %d: Process %2d spent %lu cycles on memory\n", id,
+             proc->pid, proc->cycles);
+#endif
+#if defined(MM_PAGING) && defined(MMSTAT_DUMP)
+      print_mm_stat(proc);
+#endif
+      free_proc(proc);
       proc = get_proc();
       time_left = 0;
     } else if (time_left == 0) {
@@ -83,6 +110,9 @@ static void *cpu_routine(void *args) {
       /* No process to run, exit */
       // usleep(100);
       printf("\tCPU %d stopped\n", id);
+#ifdef CPU_CYCLE_MODEL
+      printf("\tCPU %d: %lu cycles on memory\n", id, cpu_cycles);
+#endif
       break;
     } else if (proc == NULL) {
       /* There may be new processes to run in
@@ -93,10 +123,20 @@ static void *cpu_routine(void *args) {
       // usleep(100);
       printf("\tCPU %d: Dispatched process %2d\n", id, proc->pid);
       time_left = time_slot;
+#ifdef CPU_TLB
+      /* The process translates through the TLB of the CPU it runs on */
+      proc->tlb = ((struct cpu_args *)args)->tlb;
+#endif
     }
 
     /* Run current process */
+#ifdef CPU_CYCLE_MODEL
+    unsigned long cycles = proc->cycles;
+    run(proc);
+    cpu_cycles += proc->cycles - cycles;
+#else
     run(proc);
+#endif
     time_left--;
     next_slot(timer_id);
   }
@@ -111,9 +151,6 @@ static void *ld_routine(void *args) {
   struct memphy_struct *active_mswp =
       ((struct mmpaging_ld_args *)args)->active_mswp;
   struct timer_id_t *timer_id = ((struct mmpaging_ld_args *)args)->timer_id;
-#ifdef CPU_TLB
-  struct memphy_struct *tlb = ((struct mmpaging_ld_args *)args)->tlb;
-#endif
 #else
   struct timer_id_t *timer_id = (struct timer_id_t *)args;
 #endif
@@ -136,7 +173,7 @@ static void *ld_routine(void *args) {
     proc->active_mswp = active_mswp;
 #endif
 #ifdef CPU_TLB
-    proc->tlb = tlb;
+    proc->tlb = NULL; /* set on dispatch */
 #endif
     printf("\tLoaded a process at %s, PID: %d PRIO: %ld\n",
            ld_processes.path[i], proc->pid, ld_processes.prio[i]);
@@ -152,6 +189,21 @@ static void *ld_routine(void *args) {
   pthread_exit(NULL);
 }
 
+#if defined(MM_PAGING) && !defined(MM_FIXED_MEMSZ)
+/* Read an optional number left on the current config line */
+static int read_opt_field(FILE *file, int *val) {
+  int c;
+
+  fscanf(file, "%*[ \t]");
+  c = fgetc(file);
+  ungetc(c, file);
+  if (c < '0' || c > '9')
+    return 0;
+
+  return fscanf(file, "%d", val);
+}
+#endif
+
 static void read_config(const char *path) {
   FILE *file;
   if ((file = fopen(path, "r")) == NULL) {
@@ -174,12 +226,13 @@ static void read_config(const char *path) {
    */
   tlbsz = 0x10000;
 #else
-  /* Read input config of TLB size:
+  /* Read input config of TLB size, the L1 and L2 geometry are optional:
    * Format:
-   *        CPU_TLBSZ
+   *        CPU_TLBSZ [L1_ENTRIES [L2_WAYS]]
    */
-  fscanf(file, "%d\n", &tlbsz);
-  printf("%d\n", tlbsz);
+  fgets(line, sizeof(line), file);
+  sscanf(line, "%d %d %d", &tlbsz, &tlb_l1sz, &tlb_ways);
+  printf("%d %d %d\n", tlbsz, tlb_l1sz, tlb_ways);
 #endif
 #endif
 
@@ -197,15 +250,24 @@ static void read_config(const char *path) {
     memswpsz[sit] = 0;
 #else
   /* Read input config of memory size: MEMRAM and upto 4 MEMSWP (mem swap)
+   * then optionally the page size and the CPU bus width
    * Format: (size=0 result non-used memswap, must have RAM and at least 1 SWAP)
    *        MEM_RAM_SZ MEM_SWP0_SZ MEM_SWP1_SZ MEM_SWP2_SZ MEM_SWP3_SZ
+   *        [PAGE_SZ [BUS_WIDTH]]
    */
-  fscanf(file, "%d\n", &memramsz);
+  fscanf(file, "%lu\n", &memramsz);
   for (sit = 0; sit < PAGING_MAX_MMSWP; sit++)
-    fscanf(file, "%d", &(memswpsz[sit]));
+    fscanf(file, "%lu", &(memswpsz[sit]));
+  if (read_opt_field(file, &pagesz) == 1)
+    read_opt_field(file, &bus_width);
 
   fscanf(file, "\n"); /* Final character */
 #endif
+  if (paging_geom_init(pagesz, bus_width) < 0) {
+    printf("Invalid paging geometry: page size %d, bus width %d\n", pagesz,
+           bus_width);
+    exit(1);
+  }
 #endif
 
 #ifdef MLQ_SCHED
@@ -232,14 +294,24 @@ static void read_config(const char *path) {
 
 int main(int argc, char *argv[]) {
   /* Read config */
-  if (argc != 2) {
-    printf("Usage: os [path to configure file]\n");
+  int argi = 1;
+#ifdef MM_IPT
+  /* Translate through one inverted page table instead of per process ones */
+  int ipt_mode = 0;
+
+  if (argc == 3 && strcmp(argv[1], "--ipt") == 0) {
+    ipt_mode = 1;
+    argi = 2;
+  }
+#endif
+  if (argc != argi + 1) {
+    printf("Usage: os [--ipt] [path to configure file]\n");
     return 1;
   }
   char path[100];
   path[0] = '\0';
   strcat(path, "input/");
-  strcat(path, argv[1]);
+  strcat(path, argv[argi]);
   read_config(path);
 
   pthread_t *cpu = (pthread_t *)malloc(num_cpus * sizeof(pthread_t));
@@ -254,11 +326,20 @@ int main(int argc, char *argv[]) {
     args[i].id = i;
   }
   struct timer_id_t *ld_event = attach_event();
+#ifdef MM_KSWAPD
+  struct timer_id_t *kswapd_event = attach_event();
+#endif
+#ifdef MM_KSM
+  struct timer_id_t *ksmd_event = attach_event();
+#endif
   start_timer();
 #ifdef CPU_TLB
-  struct memphy_struct tlb;
+  struct tlb_struct *tlb = malloc(num_cpus * sizeof(struct tlb_struct));
 
-  init_tlbmemphy(&tlb, tlbsz);
+  for (i = 0; i < num_cpus; i++) {
+    init_tlb(&tlb[i], tlbsz, tlb_l1sz, tlb_ways);
+    args[i].tlb = &tlb[i];
+  }
 #endif
 
 #ifdef MM_PAGING
@@ -271,11 +352,35 @@ int main(int argc, char *argv[]) {
   /* Create MEM RAM */
   init_memphy(&mram, memramsz, rdmflag);
 
+#ifdef MM_ZERO_PAGE
+  /* Reserve the shared read-only zero frame */
+  MEMPHY_get_freefp(&mram, &mram.zero_fpn);
+#endif
+
+#ifdef MM_HUGEPAGE
+  /* Keep aligned frame runs for huge pages */
+  init_hpage_pool(&mram, MM_HUGEPAGE_POOL_PERCENT);
+#endif
+
+#ifdef MM_IPT
+  if (ipt_mode)
+    init_ipt(&mram);
+#endif
+
   /* Create all MEM SWAP */
   int sit;
+#ifdef MM_SWAP_SEQ
+  rdmflag = 0; /* swap is a sequential device paying for head moves */
+#endif
   for (sit = 0; sit < PAGING_MAX_MMSWP; sit++)
     init_memphy(&mswp[sit], memswpsz[sit], rdmflag);
 
+#ifdef MM_ZSWAP
+  /* Compressed cache in front of each swap device */
+  for (sit = 0; sit < PAGING_MAX_MMSWP; sit++)
+    init_zswap(&mswp[sit], memramsz / 100 * MM_ZSWAP_MAX_POOL_PERCENT);
+#endif
+
   /* In Paging mode, it needs passing the system mem to each PCB through
    * loader*/
   struct mmpaging_ld_args *mm_ld_args = malloc(sizeof(struct mmpaging_ld_args));
@@ -284,14 +389,26 @@ int main(int argc, char *argv[]) {
   mm_ld_args->mram = (struct memphy_struct *)&mram;
   mm_ld_args->mswp = (struct memphy_struct **)&mswp;
   mm_ld_args->active_mswp = (struct memphy_struct *)&mswp[0];
+
+#ifdef MM_KSWAPD
+  /* Background reclaim keeps MEMRAM above its free watermark */
+  pthread_t kswapd;
+  struct kswapd_args *kswapd_args = malloc(sizeof(struct kswapd_args));
+
+  kswapd_args->timer_id = kswapd_event;
+  kswapd_args->mram = &mram;
+  kswapd_args->mswp = &mswp[0];
+  pthread_create(&kswapd, NULL, kswapd_routine, (void *)kswapd_args);
 #endif
 
-#ifdef CPU_TLB
-#ifdef MM_PAGING
-  /* In MM_PAGING employ CPU_TLB mode, it needs passing
-   * the system tlb to each PCB through loader
-   */
-  mm_ld_args->tlb = (struct memphy_struct *)&tlb;
+#ifdef MM_KSM
+  /* Same page merging over the MEMRAM frame table */
+  pthread_t ksmd;
+  struct ksmd_args *ksmd_args = malloc(sizeof(struct ksmd_args));
+
+  ksmd_args->timer_id = ksmd_event;
+  ksmd_args->mram = &mram;
+  pthread_create(&ksmd, NULL, ksmd_routine, (void *)ksmd_args);
 #endif
 #endif
 
@@ -314,6 +431,54 @@ int main(int argc, char *argv[]) {
   }
   pthread_join(ld, NULL);
 
+#ifdef MM_KSWAPD
+  kswapd_stop();
+  pthread_join(kswapd, NULL);
+#ifdef MMSTAT_DUMP
+  print_kswapd_stat();
+#endif
+#endif
+
+#ifdef MM_KSM
+  ksmd_stop();
+  pthread_join(ksmd, NULL);
+#ifdef MMSTAT_DUMP
+  print_ksm_stat(&mram);
+#endif
+#endif
+
+#if defined(MM_HUGEPAGE) && defined(MMSTAT_DUMP)
+  print_hpage_stat(&mram);
+#endif
+
+#if defined(MM_ZSWAP) && defined(MMSTAT_DUMP)
+  print_zswap_stat(mswp[0].zswap);
+#endif
+
+#if defined(MM_PAGING) && defined(MMSTAT_DUMP)
+  print_pt_stat();
+#endif
+
+#if defined(MM_SWAP_SEQ) && defined(MMSTAT_DUMP)
+  for (sit = 0; sit < PAGING_MAX_MMSWP; sit++) {
+    char swpname[16];
+
+    if (mswp[sit].maxsz == 0)
+      continue;
+    sprintf(swpname, "MEMSWP%d", sit);
+    print_memphy_stat(&mswp[sit], swpname);
+  }
+#endif
+
+#if defined(CPU_TLB) && defined(MMSTAT_DUMP)
+  for (i = 0; i < num_cpus; i++) {
+    char tlbname[16];
+
+    sprintf(tlbname, "CPU%d", i);
+    print_tlb_stat(&tlb[i], tlbname);
+  }
+#endif
+
   /* Stop timer */
   stop_timer();
 